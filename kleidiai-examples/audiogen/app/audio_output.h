@@ -0,0 +1,187 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Arm Limited and/or its
+ * affiliates <open-source-office@arm.com>
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIOGEN_AUDIO_OUTPUT_H
+#define AUDIOGEN_AUDIO_OUTPUT_H
+
+// Conversion of the planar stereo output of the autoencoder to interleaved frames (L0, R0, L1, R1, ...)
+// of 32-bit float, or of 16-bit or 24-bit PCM with TPDF dither. As in sampler.h, the loops are
+// branchless and work on blocks of k_dither_lanes samples so that the compiler can vectorize them
+// (ST2 stores and FCVTZS conversions with NEON on Arm® CPUs), which requires -fno-trapping-math
+// for the clamping.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+enum class AudioGenSampleFormat {
+    f32,
+    pcm16,
+    pcm24,
+};
+
+// -- Number of independent xorshift generators of the dither, which is also the block size of the conversion
+constexpr size_t k_dither_lanes = 16;
+constexpr uint32_t k_dither_seed = 0x9E3779B9;
+
+inline const char* get_sample_format_name(AudioGenSampleFormat format) {
+    switch (format) {
+        case AudioGenSampleFormat::f32: return "f32";
+        case AudioGenSampleFormat::pcm16: return "pcm16";
+        case AudioGenSampleFormat::pcm24: return "pcm24";
+    }
+    return "";
+}
+
+inline bool parse_sample_format(const std::string& name, AudioGenSampleFormat& format) {
+    for (AudioGenSampleFormat f : {AudioGenSampleFormat::f32, AudioGenSampleFormat::pcm16, AudioGenSampleFormat::pcm24}) {
+        if (name == get_sample_format_name(f)) {
+            format = f;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline size_t get_bytes_per_sample(AudioGenSampleFormat format) {
+    switch (format) {
+        case AudioGenSampleFormat::f32: return 4;
+        case AudioGenSampleFormat::pcm16: return 2;
+        case AudioGenSampleFormat::pcm24: return 3;
+    }
+    return 0;
+}
+
+// Size of an interleaved stereo frame
+inline size_t get_bytes_per_frame(AudioGenSampleFormat format) {
+    return 2 * get_bytes_per_sample(format);
+}
+
+// State of the dither of a clip. Each lane is a xorshift32 generator, so that a block of
+// k_dither_lanes draws is computed in parallel
+struct AudioGenDither {
+    uint32_t state[k_dither_lanes];
+
+    AudioGenDither() {
+        for (size_t l = 0; l < k_dither_lanes; ++l) {
+            state[l] = k_dither_seed * static_cast<uint32_t>(l + 1);
+        }
+    }
+};
+
+// TPDF dither of +-1 LSB: the difference of two uniform draws in [0, 1)
+inline void generate_dither_block(AudioGenDither& dither, float* out) {
+    constexpr float k_u24_to_float = 1.0f / 16777216.0f;
+    uint32_t* s = dither.state;
+    for (size_t l = 0; l < k_dither_lanes; ++l) {
+        uint32_t x = s[l];
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        const float u1 = (x >> 8) * k_u24_to_float;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        const float u2 = (x >> 8) * k_u24_to_float;
+        s[l] = x;
+        out[l] = u1 - u2;
+    }
+}
+
+// Quantize k_dither_lanes samples in [-1, 1] to integers in [-max_int - 1, max_int], rounded to the nearest.
+// A NaN sample, which the clamping would let through to an undefined cast, is quantized as silence
+inline void quantize_block(const float* in, const float* dither, float max_int, int32_t* out) {
+    for (size_t l = 0; l < k_dither_lanes; ++l) {
+        const float sample = in[l] == in[l] ? in[l] : 0.0f;
+        const float x = std::min(std::max(sample, -1.0f), 1.0f) * max_int + dither[l];
+        const float y = std::min(std::max(x, -max_int - 1.0f), max_int);
+        out[l] = static_cast<int32_t>(y + std::copysign(0.5f, y));
+    }
+}
+
+inline void interleave_f32(const float* left_ch, const float* right_ch, size_t num_frames, float* out) {
+    for (size_t i = 0; i < num_frames; ++i) {
+        out[2 * i] = left_ch[i];
+        out[2 * i + 1] = right_ch[i];
+    }
+}
+
+// Convert num_frames planar frames to interleaved frames of format at out, which holds
+// num_frames * get_bytes_per_frame(format) bytes. The dither is only used by the PCM formats
+inline void convert_frames(const float* left_ch, const float* right_ch, size_t num_frames, AudioGenSampleFormat format,
+                           AudioGenDither& dither, void* out) {
+    if (format == AudioGenSampleFormat::f32) {
+        interleave_f32(left_ch, right_ch, num_frames, static_cast<float*>(out));
+        return;
+    }
+
+    const float max_int = format == AudioGenSampleFormat::pcm16 ? 32767.0f : 8388607.0f;
+    uint8_t* out_bytes = static_cast<uint8_t*>(out);
+
+    float in_l[k_dither_lanes];
+    float in_r[k_dither_lanes];
+    float dither_l[k_dither_lanes];
+    float dither_r[k_dither_lanes];
+    int32_t q_l[k_dither_lanes];
+    int32_t q_r[k_dither_lanes];
+
+    for (size_t i = 0; i < num_frames; i += k_dither_lanes) {
+        const size_t n = std::min(k_dither_lanes, num_frames - i);
+        const float* l = left_ch + i;
+        const float* r = right_ch + i;
+        if (n < k_dither_lanes) {
+            // The last block is padded with silence
+            std::fill(in_l, in_l + k_dither_lanes, 0.0f);
+            std::fill(in_r, in_r + k_dither_lanes, 0.0f);
+            std::copy(l, l + n, in_l);
+            std::copy(r, r + n, in_r);
+            l = in_l;
+            r = in_r;
+        }
+
+        generate_dither_block(dither, dither_l);
+        generate_dither_block(dither, dither_r);
+        quantize_block(l, dither_l, max_int, q_l);
+        quantize_block(r, dither_r, max_int, q_r);
+
+        if (format == AudioGenSampleFormat::pcm16) {
+            int16_t* dst = reinterpret_cast<int16_t*>(out_bytes) + 2 * i;
+            for (size_t j = 0; j < n; ++j) {
+                dst[2 * j] = static_cast<int16_t>(q_l[j]);
+                dst[2 * j + 1] = static_cast<int16_t>(q_r[j]);
+            }
+        } else {
+            // Little-endian 24-bit samples
+            uint8_t* dst = out_bytes + 6 * i;
+            for (size_t j = 0; j < n; ++j) {
+                const uint32_t sl = static_cast<uint32_t>(q_l[j]);
+                const uint32_t sr = static_cast<uint32_t>(q_r[j]);
+                dst[6 * j + 0] = static_cast<uint8_t>(sl);
+                dst[6 * j + 1] = static_cast<uint8_t>(sl >> 8);
+                dst[6 * j + 2] = static_cast<uint8_t>(sl >> 16);
+                dst[6 * j + 3] = static_cast<uint8_t>(sr);
+                dst[6 * j + 4] = static_cast<uint8_t>(sr >> 8);
+                dst[6 * j + 5] = static_cast<uint8_t>(sr >> 16);
+            }
+        }
+    }
+}
+
+#endif // AUDIOGEN_AUDIO_OUTPUT_H
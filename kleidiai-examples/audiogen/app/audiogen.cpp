@@ -16,398 +16,1102 @@
  * limitations under the License.
  */
 
-// LiteRT header files
-#include "tensorflow/lite/c/common.h"
-#include "tensorflow/lite/delegates/xnnpack/xnnpack_delegate.h"
-#include "tensorflow/lite/interpreter.h"
-#include "tensorflow/lite/kernels/register.h"
-#include "tensorflow/lite/model.h"
-#include "tensorflow/lite/tools/gen_op_registration.h"
+// The audiogen app is a client of libaudiogen: it parses the command line or the server jobs,
+// submits them to a libaudiogen context, and saves the audio it receives as WAV files.
+
+#include "libaudiogen.h"
+
+#include "audio_output.h"
 
 #include <algorithm>
-#include <cassert>
 #include <cctype>
+#include <cerrno>
 #include <chrono>
+#include <cmath>
+#include <csignal>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
-#include <fstream>
-#include <iterator>
-#include <random>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
-#include <sentencepiece_processor.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// ----- WAV output
+// ----------------------------------
+// The audio of a clip is appended to its WAV file as soon as libaudiogen hands it over, so the
+// file grows chunk by chunk when the decoding is chunked. The path "-" streams the WAV file to
+// the standard output, for example to pipe it to a player
+
+// WAV file of a clip
+struct AudioGenWavOutput {
+    FILE* file = nullptr;
+    size_t frame_sz = 0;
+    bool is_stdout = false;
+    // Set by a short write, for example on a full disk
+    bool write_failed = false;
+};
 
-inline long time_in_ms() {
-    using namespace std::chrono;
-    auto now = time_point_cast<milliseconds>(steady_clock::now());
-    return now.time_since_epoch().count();
+// The names of the sample formats are shared with libaudiogen, whose formats match the C ones
+static bool parse_request_format(const std::string& name, audiogen_sample_format& format) {
+    AudioGenSampleFormat sample_format;
+    if (!parse_sample_format(name, sample_format)) {
+        return false;
+    }
+    format = static_cast<audiogen_sample_format>(sample_format);
+    return true;
 }
 
-constexpr float k_audio_len_sec = 10.0f;
-constexpr size_t k_num_steps = 8;
+static bool open_wav_output(const std::string& path, size_t num_frames, audiogen_sample_format format, AudioGenWavOutput& output) {
+    output.is_stdout = path == "-";
+    output.file = output.is_stdout ? stdout : fopen(path.c_str(), "wb");
+    if (output.file == nullptr) {
+        return false;
+    }
+    output.frame_sz = audiogen_get_bytes_per_frame(format);
+    output.write_failed = false;
+    audiogen_write_wav_header(output.file, num_frames, format);
+    return true;
+}
 
-// -- Update the tensor index based on your model configuration.
-constexpr size_t k_t5_ids_in_idx = 0;
-constexpr size_t k_t5_attnmask_in_idx = 1;
-constexpr size_t k_t5_audio_len_in_idx = 2;
-constexpr size_t k_t5_crossattn_out_idx = 0;
-constexpr size_t k_t5_globalcond_out_idx = 2;
+// Return false if a write to the file failed, including the buffered data written on close
+static bool close_wav_output(AudioGenWavOutput& output) {
+    if (output.file == nullptr) {
+        return true;
+    }
+    bool ok = !output.write_failed && !ferror(output.file);
+    if (output.is_stdout) {
+        ok = fflush(output.file) == 0 && ok;
+    } else {
+        ok = fclose(output.file) == 0 && ok;
+    }
+    output.file = nullptr;
+    return ok;
+}
 
-constexpr size_t k_dit_crossattn_in_idx = 0;
-constexpr size_t k_dit_globalcond_in_idx = 1;
-constexpr size_t k_dit_x_in_idx = 2;
-constexpr size_t k_dit_t_in_idx = 3;
-constexpr size_t k_dit_out_idx = 0;
+// Each call writes a whole decoded chunk with a single fwrite. The file is only flushed when it
+// is closed, and a failed write is reported then
+static void write_wav_frames(void* user_data, const void* frames, size_t, size_t num_frames) {
+    AudioGenWavOutput* output = static_cast<AudioGenWavOutput*>(user_data);
+    if (fwrite(frames, output->frame_sz, num_frames, output->file) != num_frames) {
+        output->write_failed = true;
+    }
+}
 
-// -- Tensor size to pre-compute the sigmas
-constexpr size_t k_t_tensor_sz = k_num_steps + 1;
+// ----- Server mode
+// ----------------------------------
+// Each job is a single-line JSON object, for example:
+//   {"prompt": "warm arpeggios on house beats 120BPM", "seed": 99, "steps": 8, "length": 4.5, "output": "out_99.wav"}
+// Only "prompt" is mandatory, "length" is in seconds, and "adaptive" sets the threshold of the adaptive schedule.
+// "sampler" is "ping-pong", "euler" or "dpmpp-2m", and "logsnr_start" and "logsnr_end" set the sigma
+// schedule. "format" is the sample format of the output: "f32", "pcm16" or "pcm24". A line can also hold a JSON array of jobs, which are then
+// generated as one batch. Each line is answered, in the order of the lines, with a single-line
+// JSON object holding the status, the number of the line and the per-stage latency.
+
+// A job of the server. The strings of its request point to the members of the job
+struct AudioGenServerJob {
+    std::string prompt;
+    std::string sampler = "ping-pong";
+    std::string format = "f32";
+    std::string output_path;
+    audiogen_request request;
+};
 
-// -- Fill sigmas params
-constexpr float k_logsnr_max = -6.0f;
-constexpr float k_sigma_min = 0.0f;
-constexpr float k_sigma_max = 1.0f;
+static void skip_json_ws(const std::string& s, size_t& pos) {
+    while (pos < s.size() && std::isspace(static_cast<unsigned char>(s[pos]))) {
+        ++pos;
+    }
+}
+
+static bool parse_json_string(const std::string& s, size_t& pos, std::string& out) {
+    if (pos >= s.size() || s[pos] != '"') {
+        return false;
+    }
+    ++pos;
+    out.clear();
+    while (pos < s.size() && s[pos] != '"') {
+        char c = s[pos++];
+        if (c == '\\') {
+            if (pos >= s.size()) {
+                return false;
+            }
+            char e = s[pos++];
+            switch (e) {
+                case 'n': out.push_back('\n'); break;
+                case 't': out.push_back('\t'); break;
+                case 'r': out.push_back('\r'); break;
+                case 'b': out.push_back('\b'); break;
+                case 'f': out.push_back('\f'); break;
+                case 'u': {
+                    // Only code points in the Basic Latin block are supported
+                    if (pos + 4 > s.size()) {
+                        return false;
+                    }
+                    for (size_t i = pos; i < pos + 4; ++i) {
+                        if (!std::isxdigit(static_cast<unsigned char>(s[i]))) {
+                            return false;
+                        }
+                    }
+                    const unsigned long cp = std::strtoul(s.substr(pos, 4).c_str(), nullptr, 16);
+                    if (cp > 0x7f) {
+                        return false;
+                    }
+                    out.push_back(static_cast<char>(cp));
+                    pos += 4;
+                    break;
+                }
+                default: out.push_back(e); break;
+            }
+        } else {
+            out.push_back(c);
+        }
+    }
+    if (pos >= s.size()) {
+        return false;
+    }
+    ++pos; // Closing quote
+    return true;
+}
+
+static bool parse_json_uint(const std::string& s, size_t& pos, size_t& out) {
+    const size_t begin = pos;
+    while (pos < s.size() && std::isdigit(static_cast<unsigned char>(s[pos]))) {
+        ++pos;
+    }
+    if (pos == begin) {
+        return false;
+    }
+    // A number that does not fit in 64 bits is an invalid value, not an error of the server
+    const std::string digits = s.substr(begin, pos - begin);
+    errno = 0;
+    const unsigned long long value = std::strtoull(digits.c_str(), nullptr, 10);
+    if (errno == ERANGE || value > std::numeric_limits<size_t>::max()) {
+        return false;
+    }
+    out = static_cast<size_t>(value);
+    return true;
+}
+
+// A JSON number, -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?, which must be finite as a float.
+// strtof() alone would also accept nan, inf, hexadecimal numbers and a leading '+'
+static bool parse_json_float(const std::string& s, size_t& pos, float& out) {
+    size_t end = pos;
+    const auto skip_digits = [&s, &end]() {
+        const size_t begin = end;
+        while (end < s.size() && std::isdigit(static_cast<unsigned char>(s[end]))) {
+            ++end;
+        }
+        return end > begin;
+    };
+
+    if (end < s.size() && s[end] == '-') {
+        ++end;
+    }
+    if (end < s.size() && s[end] == '0') {
+        ++end;
+    } else if (!skip_digits()) {
+        return false;
+    }
+    if (end < s.size() && s[end] == '.') {
+        ++end;
+        if (!skip_digits()) {
+            return false;
+        }
+    }
+    if (end < s.size() && (s[end] == 'e' || s[end] == 'E')) {
+        ++end;
+        if (end < s.size() && (s[end] == '+' || s[end] == '-')) {
+            ++end;
+        }
+        if (!skip_digits()) {
+            return false;
+        }
+    }
 
-#define AUDIOGEN_CHECK(x)                                 \
-    if (!(x)) {                                                 \
-        fprintf(stderr, "Error at %s:%d\n", __FILE__, __LINE__);\
-        exit(1);                                                \
+    const float value = std::strtof(s.substr(pos, end - pos).c_str(), nullptr);
+    if (!std::isfinite(value)) {
+        return false;
     }
+    out = value;
+    pos = end;
+    return true;
+}
 
-static std::vector<int32_t> convert_prompt_to_ids(const std::string& prompt, const std::string& spiece_model_path) {
-    sentencepiece::SentencePieceProcessor sp;
+static bool parse_job_object(const std::string& line, size_t& pos, AudioGenServerJob& job, std::string& error) {
+    bool has_prompt = false;
 
-    AUDIOGEN_CHECK(sp.Load(spiece_model_path.c_str()).ok());
+    skip_json_ws(line, pos);
+    if (pos >= line.size() || line[pos] != '{') {
+        error = "expected a JSON object";
+        return false;
+    }
+    ++pos;
 
-    std::vector<std::string> pieces;
-    std::vector<int32_t> ids;
+    skip_json_ws(line, pos);
+    if (pos < line.size() && line[pos] == '}') {
+        error = "missing \"prompt\"";
+        return false;
+    }
 
-    sp.Encode(prompt, &pieces);  // Token strings
-    sp.Encode(prompt, &ids);     // Token IDs
+    while (pos < line.size()) {
+        std::string key;
+        skip_json_ws(line, pos);
+        if (!parse_json_string(line, pos, key)) {
+            error = "invalid key";
+            return false;
+        }
+        skip_json_ws(line, pos);
+        if (pos >= line.size() || line[pos] != ':') {
+            error = "expected ':' after \"" + key + "\"";
+            return false;
+        }
+        ++pos;
+        skip_json_ws(line, pos);
+
+        bool ok = false;
+        size_t value = 0;
+        if (key == "prompt") {
+            ok = parse_json_string(line, pos, job.prompt);
+            has_prompt = ok;
+        } else if (key == "output") {
+            ok = parse_json_string(line, pos, job.output_path);
+        } else if (key == "seed") {
+            ok = parse_json_uint(line, pos, value);
+            if (ok) {
+                job.request.seed = value;
+            }
+        } else if (key == "steps") {
+            ok = parse_json_uint(line, pos, job.request.num_steps) && job.request.num_steps > 0;
+        } else if (key == "length") {
+            ok = parse_json_float(line, pos, job.request.audio_len_sec) && job.request.audio_len_sec > 0.0f;
+        } else if (key == "adaptive") {
+            ok = parse_json_float(line, pos, job.request.adaptive_threshold) && job.request.adaptive_threshold >= 0.0f;
+        } else if (key == "sampler") {
+            ok = parse_json_string(line, pos, job.sampler);
+        } else if (key == "format") {
+            ok = parse_json_string(line, pos, job.format) && parse_request_format(job.format, job.request.format);
+        } else if (key == "logsnr_start") {
+            ok = parse_json_float(line, pos, job.request.logsnr_start);
+        } else if (key == "logsnr_end") {
+            ok = parse_json_float(line, pos, job.request.logsnr_end);
+        } else {
+            error = "unknown key \"" + key + "\"";
+            return false;
+        }
+
+        if (!ok) {
+            error = "invalid value for \"" + key + "\"";
+            return false;
+        }
+
+        skip_json_ws(line, pos);
+        if (pos < line.size() && line[pos] == ',') {
+            ++pos;
+            continue;
+        }
+        if (pos < line.size() && line[pos] == '}') {
+            ++pos;
+            break;
+        }
+        error = "expected ',' or '}'";
+        return false;
+    }
 
-    // Make sure we have 1 at the end
-    if(ids[ids.size() - 1] != 1) {
-        ids.push_back(1);
+    if (!has_prompt) {
+        error = "missing \"prompt\"";
+        return false;
     }
-    return ids;
+    return true;
 }
 
-static void save_as_wav(const std::string& path, const float* left_ch, const float* right_ch, size_t buffer_sz) {
-    constexpr int32_t audio_sr = 44100;
-    constexpr int32_t audio_num_channels = 2;
-    constexpr int32_t audio_bits_per_sample = 32;
-    constexpr uint16_t audio_format = 3; // IEEE float
-
-    const int32_t byte_rate = audio_sr * audio_num_channels * (audio_bits_per_sample / 8);
-    const int32_t block_align = audio_num_channels * (audio_bits_per_sample / 8);
-    const int32_t data_chunk_sz = buffer_sz * 2 * sizeof(float);
-    const int32_t fmt_chunk_sz = 16;
-    const int32_t header_sz = 44;
-    const int32_t file_sz = header_sz + data_chunk_sz - 8;
-
-    std::ofstream out_file(path, std::ios::binary);
-
-    // Prepare the header
-    // RIFF header
-    out_file.write("RIFF", 4);
-    out_file.write(reinterpret_cast<const char*>(&file_sz), 4);
-    out_file.write("WAVE", 4);
-    out_file.write("fmt ", 4);
-    out_file.write(reinterpret_cast<const char*>(&fmt_chunk_sz), 4);
-    out_file.write(reinterpret_cast<const char*>(&audio_format), 2);
-    out_file.write(reinterpret_cast<const char*>(&audio_num_channels), 2);
-    out_file.write(reinterpret_cast<const char*>(&audio_sr), 4);
-    out_file.write(reinterpret_cast<const char*>(&byte_rate), 4);
-    out_file.write(reinterpret_cast<const char*>(&block_align), 2);
-    out_file.write(reinterpret_cast<const char*>(&audio_bits_per_sample), 2);
-
-    // Store the data in interleaved format (L0, R0, L1, R1,....)
-    out_file.write("data", 4);
-    out_file.write(reinterpret_cast<const char*>(&data_chunk_sz), 4);
-
-    for (size_t i = 0; i < buffer_sz; ++i) {
-        out_file.write(reinterpret_cast<const char*>(&left_ch[i]), sizeof(float));
-        out_file.write(reinterpret_cast<const char*>(&right_ch[i]), sizeof(float));
-    }
-
-    out_file.close();
-}
+// Parse either a single job object or an array of job objects. The jobs of an array
+// are denoised together as one DiT batch, which libaudiogen validates
+static bool parse_jobs_json(const std::string& line, size_t first_job_idx, std::vector<AudioGenServerJob>& jobs, std::string& error) {
+    size_t pos = 0;
+    skip_json_ws(line, pos);
 
-static void fill_random_norm_dist(float* buff, size_t buff_sz, size_t seed) {
-    std::random_device rd{};
-    std::mt19937 gen(seed);
-    std::normal_distribution<float> dis(0.0f, 1.0f);
+    const bool is_array = pos < line.size() && line[pos] == '[';
+    if (is_array) {
+        ++pos;
+    }
 
-    auto gen_fn = [&dis, &gen](){ return dis(gen); };
-    std::generate(buff, buff + buff_sz, gen_fn);
+    while (true) {
+        AudioGenServerJob job;
+        audiogen_request_init(&job.request);
+        const size_t job_idx = first_job_idx + jobs.size();
+        job.request.seed = job_idx;
+        job.output_path = "output_" + std::to_string(job_idx) + ".wav";
+
+        if (!parse_job_object(line, pos, job, error)) {
+            return false;
+        }
+        jobs.push_back(job);
+
+        skip_json_ws(line, pos);
+        if (!is_array) {
+            break;
+        }
+        if (pos < line.size() && line[pos] == ',') {
+            ++pos;
+            continue;
+        }
+        if (pos < line.size() && line[pos] == ']') {
+            ++pos;
+            break;
+        }
+        error = "expected ',' or ']'";
+        return false;
+    }
+    return true;
 }
 
-static void fill_sigmas(std::vector<float>& arr, float start, float end) {
-
-    const int32_t sz = static_cast<int32_t>(arr.size());
-    const float step = ((end - start) / static_cast<float> (sz - 1));
+static std::string json_escape(const std::string& s) {
+    std::string out;
+    for (char c : s) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            case '\r': out += "\\r"; break;
+            default: out.push_back(c); break;
+        }
+    }
+    return out;
+}
 
-    // Linspace
-    arr[0]      = start;
-    arr[sz - 1] = end;
+// The answers start with the number of their line, from 1
+static std::string format_error_response(size_t line_no, const std::string& error) {
+    return "{\"status\": \"error\", \"line\": " + std::to_string(line_no) + ", \"error\": \"" + json_escape(error) + "\"}";
+}
 
-    for(int32_t i = 1; i < sz - 1; ++i) {
-        arr[i] = arr[i - 1] + step;
+static std::string format_response(size_t line_no, const std::vector<AudioGenServerJob>& jobs, const audiogen_timings& timings) {
+    std::string outputs;
+    std::string seeds;
+    for (size_t b = 0; b < jobs.size(); ++b) {
+        outputs += (b == 0 ? "\"" : ", \"") + json_escape(jobs[b].output_path) + "\"";
+        seeds += (b == 0 ? "" : ", ") + std::to_string(jobs[b].request.seed);
     }
 
-    for(int32_t i = 0; i < sz; ++i) {
-        arr[i] = 1.0f / (1.0f + std::exp(arr[i])) ;
+    const bool is_batch = jobs.size() > 1;
+
+    std::string step_times;
+    for (size_t i = 0; i < timings.num_dit_steps; ++i) {
+        char step_time[32];
+        snprintf(step_time, sizeof(step_time), "%s%.3f", i == 0 ? "" : ", ", timings.dit_step_ms[i]);
+        step_times += step_time;
     }
 
-    arr[0]      = k_sigma_max;
-    arr[sz - 1] = k_sigma_min;
+    char buf[512];
+    snprintf(buf, sizeof(buf),
+             "\"steps\": %zu, \"sampler\": \"%s\", \"tokenizer_ms\": %ld, \"t5_ms\": %ld, \"dit_ms\": %ld, \"dit_avg_step_ms\": %f, "
+             "\"autoencoder_ms\": %ld, \"save_ms\": %ld, \"total_ms\": %ld, \"first_sample_ms\": %ld, \"wall_ms\": %ld, "
+             "\"cond_cache_hits\": %zu, \"dit_steps_run\": %zu, \"dit_steps_saved\": %zu",
+             jobs[0].request.num_steps, json_escape(jobs[0].sampler).c_str(), timings.tokenizer_ms, timings.t5_ms, timings.dit_ms, timings.dit_avg_step_ms,
+             timings.autoencoder_ms, timings.output_ms, timings.total_ms, timings.first_sample_ms, timings.wall_ms,
+             timings.cond_cache_hits, timings.dit_steps_run, timings.dit_steps_saved);
+
+    return "{\"status\": \"ok\", \"line\": " + std::to_string(line_no) + ", " +
+           (is_batch ? "\"batch\": " + std::to_string(jobs.size()) + ", \"outputs\": [" + outputs + "], \"seeds\": [" + seeds + "], "
+                     : "\"output\": " + outputs + ", \"seed\": " + seeds + ", ") +
+           buf + ", \"dit_step_ms\": [" + step_times + "]}";
 }
 
-static void sampler_ping_pong(float* dit_out_data, float* dit_x_in_data, size_t dit_x_in_sz, float cur_t, float next_t, size_t step_idx, size_t seed) {
+using AudioGenResponder = std::function<void(const std::string&)>;
 
-    for(size_t i = 0; i < dit_x_in_sz; i++) {
-        dit_out_data[i] = dit_x_in_data[i] - ( cur_t * dit_out_data[i]);
+// Send the answers in the order of the lines. In pipeline mode, an invalid line is answered while
+// the lines before it are still generated, so its answer waits for theirs
+class AudioGenOrderedResponder {
+public:
+    explicit AudioGenOrderedResponder(AudioGenResponder send) : send_(std::move(send)) {}
+
+    // Number of the next line, from 1
+    size_t add_line() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return ++num_lines_;
+    }
+
+    void respond(size_t line_no, const std::string& response) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ready_[line_no] = response;
+        while (!ready_.empty() && ready_.begin()->first == num_sent_ + 1) {
+            send_(ready_.begin()->second);
+            ready_.erase(ready_.begin());
+            ++num_sent_;
+        }
     }
 
-    fill_random_norm_dist(dit_x_in_data, dit_x_in_sz, seed);
+private:
+    AudioGenResponder send_;
+    size_t num_lines_ = 0;
+    size_t num_sent_ = 0;
+    std::map<size_t, std::string> ready_;
+    std::mutex mutex_;
+};
 
-    // x = (1-t_next) * denoised + t_next * torch.randn_like(x)
-    for(size_t i = 0; i < dit_x_in_sz; i++) {
-        dit_x_in_data[i] = ((1.0f - next_t) * dit_out_data[i]) + (next_t * dit_x_in_data[i]);
+// The jobs of a line, with their output files, until libaudiogen completes them
+struct AudioGenServerSubmission {
+    std::vector<AudioGenServerJob> jobs;
+    // The callbacks point to the outputs, so the vector is never resized after it is filled
+    std::vector<AudioGenWavOutput> files;
+    size_t line_no = 0;
+    AudioGenResponder respond;
+};
+
+// Close the output files, and return the path of the first one that could not be written, or an
+// empty string. The files are removed after a failed generation or write
+static std::string close_files(AudioGenServerSubmission& submission, bool remove_files) {
+    std::string failed_path;
+    std::vector<size_t> opened;
+    for (size_t b = 0; b < submission.files.size(); ++b) {
+        if (submission.files[b].file == nullptr) {
+            continue;
+        }
+        opened.push_back(b);
+        if (!close_wav_output(submission.files[b]) && failed_path.empty()) {
+            failed_path = submission.jobs[b].output_path;
+        }
+    }
+    if (remove_files || !failed_path.empty()) {
+        for (size_t b : opened) {
+            std::remove(submission.jobs[b].output_path.c_str());
+        }
     }
+    return failed_path;
 }
 
-static size_t get_num_elems(const TfLiteIntArray* dims) {
-    size_t x = 1;
-    for (size_t i = 0; i < dims->size; ++i) {
-        x *= dims->data[i];
+static void on_submission_done(void* user_data, const audiogen_result* result) {
+    std::unique_ptr<AudioGenServerSubmission> submission(static_cast<AudioGenServerSubmission*>(user_data));
+    const std::string failed_path = close_files(*submission, result->status != AUDIOGEN_OK);
+    if (result->status != AUDIOGEN_OK) {
+        submission->respond(format_error_response(submission->line_no, result->error));
+    } else if (!failed_path.empty()) {
+        submission->respond(format_error_response(submission->line_no, "cannot write " + failed_path));
+    } else {
+        submission->respond(format_response(submission->line_no, submission->jobs, result->timings));
     }
-    return x;
 }
 
-struct TfLiteDelegateDeleter {
-    void operator()(TfLiteDelegate* delegate) const {
-        TfLiteXNNPackDelegateDelete(delegate);
+// Submit the jobs of a line and send the answer with responder, from a thread of the context
+// once the jobs are completed. The responder keeps the answers in the order of the lines, and
+// without a pipeline, the jobs are completed before the next line is read
+static void handle_job_line(audiogen_context* context, bool pipeline, const std::string& line, size_t& job_idx,
+                            const std::shared_ptr<AudioGenOrderedResponder>& responder) {
+    const size_t line_no = responder->add_line();
+    const AudioGenResponder respond = [responder, line_no](const std::string& response) {
+        responder->respond(line_no, response);
+    };
+
+    auto submission = std::make_unique<AudioGenServerSubmission>();
+    submission->line_no = line_no;
+    std::string error;
+    if (!parse_jobs_json(line, job_idx, submission->jobs, error)) {
+        respond(format_error_response(line_no, error));
+        return;
     }
-};
+    job_idx += submission->jobs.size();
 
-int main(int32_t argc, char** argv) {
+    std::vector<AudioGenServerJob>& jobs = submission->jobs;
+    const size_t num_frames = audiogen_get_num_frames(context, jobs[0].request.audio_len_sec);
 
-    if (argc != 5) {
-        printf("ERROR: Usage ./audiogen <models_base_path> <prompt> <num_threads> <seed>\n");
-        return 1;
+    // The standard output is reserved to the answers
+    for (const AudioGenServerJob& job : jobs) {
+        if (job.output_path == "-") {
+            respond(format_error_response(line_no, "the output cannot be the standard output in server mode"));
+            return;
+        }
     }
 
-    // ----- Parse the cmd line arguments
-    // ----------------------------------
-    const std::string models_base_path = argv[1];
-    const std::string prompt = argv[2];
-    const size_t num_threads = std::stoull(argv[3]);
-    const size_t seed = std::stoull(argv[4]);
-
-    std::string t5_tflite = models_base_path + "/conditioners_float32.tflite";
-    std::string dit_tflite = models_base_path + "/dit_model.tflite";
-    std::string autoencoder_tflite = models_base_path + "/autoencoder_model.tflite";
-    std::string output_path = "output.wav";
-    std::string sentence_model_path = models_base_path + "/spiece.model";
+    std::vector<audiogen_request> requests;
+    submission->files.resize(jobs.size());
+    for (size_t b = 0; b < jobs.size(); ++b) {
+        AudioGenServerJob& job = jobs[b];
+        if (!open_wav_output(job.output_path, num_frames, job.request.format, submission->files[b])) {
+            close_files(*submission, true);
+            respond(format_error_response(line_no, "cannot open " + job.output_path));
+            return;
+        }
+
+        job.request.prompt = job.prompt.c_str();
+        job.request.sampler = job.sampler.c_str();
+        job.request.on_audio = write_wav_frames;
+        job.request.user_data = &submission->files[b];
+        requests.push_back(job.request);
+    }
+    submission->respond = respond;
+
+    audiogen_handle* handle = nullptr;
+    const audiogen_status status = audiogen_generate(context, requests.data(), requests.size(), on_submission_done, submission.get(),
+                                                     pipeline ? nullptr : &handle);
+    if (status != AUDIOGEN_OK) {
+        close_files(*submission, true);
+        respond(format_error_response(line_no, audiogen_last_error()));
+        return;
+    }
 
-    // ----- Load the models
-    // ----------------------------------
-    std::unique_ptr<tflite::FlatBufferModel> t5_model = tflite::FlatBufferModel::BuildFromFile(t5_tflite.c_str());
-    AUDIOGEN_CHECK(t5_model != nullptr);
+    // The submission is deleted by on_submission_done
+    submission.release();
+    if (handle != nullptr) {
+        audiogen_wait(handle, nullptr);
+        audiogen_release(handle);
+    }
+}
 
-    std::unique_ptr<tflite::FlatBufferModel> dit_model = tflite::FlatBufferModel::BuildFromFile(dit_tflite.c_str());
-    AUDIOGEN_CHECK(dit_model != nullptr);
+static bool is_blank(const std::string& s) {
+    return std::all_of(s.begin(), s.end(), [](unsigned char c){ return std::isspace(c); });
+}
 
-    std::unique_ptr<tflite::FlatBufferModel> autoencoder_model = tflite::FlatBufferModel::BuildFromFile(autoencoder_tflite.c_str());
-    AUDIOGEN_CHECK(autoencoder_model != nullptr);
+static long time_in_ms() {
+    using namespace std::chrono;
+    auto now = time_point_cast<milliseconds>(steady_clock::now());
+    return now.time_since_epoch().count();
+}
 
-    // ----- Build the interpreters
-    // ----------------------------------
-    tflite::ops::builtin::BuiltinOpResolver resolver;
+static void run_server_stdin(audiogen_context* context, bool pipeline) {
+    auto responder = std::make_shared<AudioGenOrderedResponder>([](const std::string& response) {
+        std::cout << response << std::endl;
+    });
 
-    tflite::InterpreterBuilder t5_builder(*t5_model, resolver);
-    tflite::InterpreterBuilder dit_builder(*dit_model, resolver);
-    tflite::InterpreterBuilder autoencoder_builder(*autoencoder_model, resolver);
+    std::string line;
+    size_t job_idx = 0;
 
-    std::unique_ptr<tflite::Interpreter> t5_interpreter = std::make_unique<tflite::Interpreter>();
-    t5_builder(&t5_interpreter);
-    AUDIOGEN_CHECK(t5_interpreter != nullptr);
+    auto start = time_in_ms();
 
-    std::unique_ptr<tflite::Interpreter> dit_interpreter = std::make_unique<tflite::Interpreter>();
-    dit_builder(&dit_interpreter);
-    AUDIOGEN_CHECK(dit_interpreter != nullptr);
+    while (std::getline(std::cin, line)) {
+        if (is_blank(line)) {
+            continue;
+        }
+        handle_job_line(context, pipeline, line, job_idx, responder);
+    }
 
-    std::unique_ptr<tflite::Interpreter> autoencoder_interpreter = std::make_unique<tflite::Interpreter>();
-    autoencoder_builder(&autoencoder_interpreter);
-    AUDIOGEN_CHECK(autoencoder_interpreter != nullptr);
+    audiogen_flush(context);
 
-    // Create the XNNPACK delegate options
-    TfLiteXNNPackDelegateOptions xnnpack_options = TfLiteXNNPackDelegateOptionsDefault();
-    xnnpack_options.num_threads = num_threads;
+    auto end = time_in_ms();
 
-    xnnpack_options.flags |= TFLITE_XNNPACK_DELEGATE_FLAG_QS8;
-    xnnpack_options.flags |= TFLITE_XNNPACK_DELEGATE_FLAG_QU8;
-    xnnpack_options.flags |= TFLITE_XNNPACK_DELEGATE_FLAG_DYNAMIC_FULLY_CONNECTED;
-    xnnpack_options.flags |= TFLITE_XNNPACK_DELEGATE_FLAG_ENABLE_SUBGRAPH_RESHAPING;
-    xnnpack_options.flags |= TFLITE_XNNPACK_DELEGATE_FLAG_ENABLE_LATEST_OPERATORS;
-    xnnpack_options.flags |= TFLITE_XNNPACK_DELEGATE_FLAG_VARIABLE_OPERATORS;
+    if (job_idx > 0) {
+        fprintf(stderr, "Generated %zu clips in %ld ms (%f clips/s)\n", job_idx, end - start, job_idx * 1000.0f / (end - start));
+    }
+    audiogen_print_stats(context, stderr);
+}
 
-    // XNNPack delegate options for the T5 and DiT models
-    std::unique_ptr<TfLiteDelegate, TfLiteDelegateDeleter> xnnpack_delegate_fp32(TfLiteXNNPackDelegateCreate(&xnnpack_options));
+// The client socket is closed once the last pending response has been sent
+struct ClientConnection {
+    explicit ClientConnection(int32_t client_fd) : fd(client_fd) {}
+    ~ClientConnection() {
+        close(fd);
+    }
 
-    // XNNPack delegate options for the autoencoder model.
-    // We force the FP16 computation just to the most computatioannly expensive model
-    xnnpack_options.flags |= TFLITE_XNNPACK_DELEGATE_FLAG_FORCE_FP16;
-    std::unique_ptr<TfLiteDelegate, TfLiteDelegateDeleter> xnnpack_delegate_fp16(TfLiteXNNPackDelegateCreate(&xnnpack_options));
+    const int32_t fd;
+};
 
-    // Add the delegate to the interpreter
-    if (t5_interpreter->ModifyGraphWithDelegate(xnnpack_delegate_fp32.get()) != kTfLiteOk) {
-        AUDIOGEN_CHECK(false && "Failed to apply XNNPACK delegate");
+static bool write_all(int32_t fd, const std::string& data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        const ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if (n <= 0) {
+            return false;
+        }
+        written += n;
     }
+    return true;
+}
 
-    if (dit_interpreter->ModifyGraphWithDelegate(xnnpack_delegate_fp32.get()) != kTfLiteOk) {
-        AUDIOGEN_CHECK(false && "Failed to apply XNNPACK delegate");
+// Return only when the socket cannot be set up
+static void run_server_socket(audiogen_context* context, bool pipeline, const std::string& socket_path) {
+    // The clients are served one after another. Without a pipeline, the jobs of a
+    // client are also executed one at a time
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "ERROR: the socket path is too long\n");
+        return;
+    }
+    strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+
+    // The socket of a previous server is replaced, but any other file is left untouched
+    struct stat path_stat;
+    if (lstat(socket_path.c_str(), &path_stat) == 0) {
+        if (!S_ISSOCK(path_stat.st_mode)) {
+            fprintf(stderr, "ERROR: %s exists and is not a socket\n", socket_path.c_str());
+            return;
+        }
+        unlink(socket_path.c_str());
     }
 
-    if (autoencoder_interpreter->ModifyGraphWithDelegate(xnnpack_delegate_fp16.get()) != kTfLiteOk) {
-        AUDIOGEN_CHECK(false && "Failed to apply XNNPACK delegate");
+    const int32_t server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server_fd < 0) {
+        fprintf(stderr, "ERROR: cannot create the socket\n");
+        return;
+    }
+    if (bind(server_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(server_fd, 8) != 0) {
+        fprintf(stderr, "ERROR: cannot listen on %s\n", socket_path.c_str());
+        close(server_fd);
+        return;
     }
 
-    // ----- Allocate the tensors
-    // ----------------------------------
-    AUDIOGEN_CHECK(t5_interpreter->AllocateTensors() == kTfLiteOk);
-    AUDIOGEN_CHECK(dit_interpreter->AllocateTensors() == kTfLiteOk);
-    AUDIOGEN_CHECK(autoencoder_interpreter->AllocateTensors() == kTfLiteOk);
+    // A client closing its connection early must not terminate the server
+    signal(SIGPIPE, SIG_IGN);
+
+    fprintf(stderr, "Listening on %s\n", socket_path.c_str());
+
+    size_t job_idx = 0;
+    while (true) {
+        const int32_t client_fd = accept(server_fd, nullptr, nullptr);
+        if (client_fd < 0) {
+            continue;
+        }
+
+        auto connection = std::make_shared<ClientConnection>(client_fd);
+        auto responder = std::make_shared<AudioGenOrderedResponder>([connection](const std::string& response) {
+            write_all(connection->fd, response + "\n");
+        });
+
+        std::string pending;
+        char buf[4096];
+        ssize_t n = 0;
+        while ((n = read(client_fd, buf, sizeof(buf))) > 0) {
+            pending.append(buf, n);
+
+            size_t eol = 0;
+            while ((eol = pending.find('\n')) != std::string::npos) {
+                const std::string line = pending.substr(0, eol);
+                pending.erase(0, eol + 1);
+                if (is_blank(line)) {
+                    continue;
+                }
+                handle_job_line(context, pipeline, line, job_idx, responder);
+            }
+        }
+    }
+}
 
-    // ----- Get the input & output tensors pointers
-    // ----------------------------------
-    const size_t t5_ids_in_id = t5_interpreter->inputs()[k_t5_ids_in_idx];
-    const size_t t5_attnmask_in_id = t5_interpreter->inputs()[k_t5_attnmask_in_idx];
-    const size_t t5_time_in_id = t5_interpreter->inputs()[k_t5_audio_len_in_idx];
-
-    const size_t t5_crossattn_out_id = t5_interpreter->outputs()[k_t5_crossattn_out_idx];
-    const size_t t5_globalcond_out_id = t5_interpreter->outputs()[k_t5_globalcond_out_idx];
-
-    const size_t dit_x_in_id = dit_interpreter->inputs()[k_dit_x_in_idx];
-    const size_t dit_t_in_id = dit_interpreter->inputs()[k_dit_t_in_idx];
-    const size_t dit_crossattn_in_id = dit_interpreter->inputs()[k_dit_crossattn_in_idx];
-    const size_t dit_globalcond_in_id = dit_interpreter->inputs()[k_dit_globalcond_in_idx];
-    const size_t dit_out_id = dit_interpreter->outputs()[k_dit_out_idx];
-
-    const size_t autoencoder_in_id = autoencoder_interpreter->inputs()[0];
-    const size_t autoencoder_out_id = autoencoder_interpreter->outputs()[0];
-
-    int64_t* t5_ids_in_data = t5_interpreter->typed_tensor<int64_t>(t5_ids_in_id);
-    int64_t* t5_attnmask_in_data = t5_interpreter->typed_tensor<int64_t>(t5_attnmask_in_id);
-    float* t5_time_in_data = t5_interpreter->typed_tensor<float>(t5_time_in_id);
-    float* t5_crossattn_out_data = t5_interpreter->typed_tensor<float>(t5_crossattn_out_id);
-    float* t5_globalcond_out_data = t5_interpreter->typed_tensor<float>(t5_globalcond_out_id);
-
-    float* dit_x_in_data = dit_interpreter->typed_tensor<float>(dit_x_in_id);
-    float* dit_t_in_data = dit_interpreter->typed_tensor<float>(dit_t_in_id);
-    float* dit_crossattn_in_data = dit_interpreter->typed_tensor<float>(dit_crossattn_in_id);
-    float* dit_globalcond_in_data = dit_interpreter->typed_tensor<float>(dit_globalcond_in_id);
-    float* dit_out_data = dit_interpreter->typed_tensor<float>(dit_out_id);
-    float* autoencoder_in_data = autoencoder_interpreter->typed_tensor<float>(autoencoder_in_id);
-    float* autoencoder_out_data = autoencoder_interpreter->typed_tensor<float>(autoencoder_out_id);
-
-    // ----- Get the input & output tensors dimensions
-    // ----------------------------------
-    TfLiteIntArray* t5_ids_in_dims = t5_interpreter->tensor(t5_ids_in_id)->dims;
-    TfLiteIntArray* t5_attnmask_in_dims = t5_interpreter->tensor(t5_attnmask_in_id)->dims;
-    TfLiteIntArray* t5_crossattn_out_dims = t5_interpreter->tensor(t5_crossattn_out_id)->dims;
-    TfLiteIntArray* t5_globalcond_out_dims = t5_interpreter->tensor(t5_globalcond_out_id)->dims;
+// ||test - ref|| / ||ref||, for 32-bit float frames
+static float get_relative_deviation(const std::vector<uint8_t>& ref_bytes, const std::vector<uint8_t>& test_bytes) {
+    const float* ref = reinterpret_cast<const float*>(ref_bytes.data());
+    const float* test = reinterpret_cast<const float*>(test_bytes.data());
+    double diff_sq = 0.0;
+    double norm_sq = 0.0;
+    for (size_t i = 0; i < std::min(ref_bytes.size(), test_bytes.size()) / sizeof(float); ++i) {
+        const double diff = static_cast<double>(test[i]) - ref[i];
+        diff_sq += diff * diff;
+        norm_sq += static_cast<double>(ref[i]) * ref[i];
+    }
+    return norm_sq > 0.0 ? static_cast<float>(std::sqrt(diff_sq / norm_sq)) : 0.0f;
+}
 
-    TfLiteIntArray* dit_x_in_dims = dit_interpreter->tensor(dit_x_in_id)->dims;
-    TfLiteIntArray* dit_crossattn_in_dims = dit_interpreter->tensor(dit_crossattn_in_id)->dims;
-    TfLiteIntArray* dit_globalcond_in_dims = dit_interpreter->tensor(dit_globalcond_in_id)->dims;
-    TfLiteIntArray* autoencoder_in_dims = autoencoder_interpreter->tensor(autoencoder_in_id)->dims;
-    TfLiteIntArray* autoencoder_out_dims = autoencoder_interpreter->tensor(autoencoder_out_id)->dims;
+// Optional command line arguments. The strings of the config and of the request point to argv
+struct AudioGenOptions {
+    audiogen_config config;
 
-    // ----- Allocate the extra buffer to pre-compute the sigmas
-    std::vector<float> t_buffer(k_t_tensor_sz);
+    // Template of the jobs of the command line
+    audiogen_request request;
+    size_t batch_sz = 1;
 
-    // ----- Initialize the T and X buffers
-    fill_random_norm_dist(dit_x_in_data, get_num_elems(dit_x_in_dims), seed);
-    fill_sigmas(t_buffer, k_logsnr_max, 2.0f);
+    // Path of the WAV file of a single clip, or "-" for the standard output
+    const char* output_path = nullptr;
 
-    // Convert the prompt to IDs
-    std::vector<int32_t> ids = convert_prompt_to_ids(prompt, sentence_model_path);
+    const char* profile_path = nullptr;
+    size_t profile_top = 20;
 
-    // Initialize the t5_ids_in_data
-    memset(t5_ids_in_data, 0, get_num_elems(t5_ids_in_dims) * sizeof(int64_t));
+    bool adaptive_check = false;
+};
 
-    for(size_t i = 0; i < ids.size(); ++i) {
-        t5_ids_in_data[i] = ids[i];
-    }
+static void print_usage() {
+    audiogen_config config;
+    audiogen_config_init(&config, 1);
+    audiogen_request request;
+    audiogen_request_init(&request);
+
+    printf("ERROR: Usage ./audiogen <models_base_path> <prompt> <num_threads> <seed> [options]\n");
+    printf("       ./audiogen <models_base_path> --server <num_threads> [<socket_path>] [options]\n");
+    printf("Options:\n");
+    printf("  --length <sec>             Length of the generated audio, in seconds (default: %.0f)\n", request.audio_len_sec);
+    printf("  --batch <n>                Generate <n> seed variations of the prompt with a single DiT batch\n");
+    printf("  --t5-threads <n>           Number of threads of the T5 stage (default: <num_threads>)\n");
+    printf("  --dit-threads <n>          Number of threads of the DiT stage (default: <num_threads>)\n");
+    printf("  --autoencoder-threads <n>  Number of threads of the autoencoder stage (default: <num_threads>)\n");
+    printf("  --t5-precision <p>         Precision of the T5 stage: fp32, fp16 or int8 (default: fp32)\n");
+    printf("  --dit-precision <p>        Precision of the DiT stage: fp32, fp16 or int8 (default: int8)\n");
+    printf("  --autoencoder-precision <p>  Precision of the autoencoder stage: fp32, fp16 or int8 (default: fp16)\n");
+    printf("  --affinity <policy>        Pin the stages to CPU clusters: none, little, big or prime (default: none)\n");
+    printf("  --t5-cpus <list>           CPUs of the T5 stage, like 0-3,6. Overrides --affinity\n");
+    printf("  --dit-cpus <list>          CPUs of the DiT stage. Overrides --affinity\n");
+    printf("  --autoencoder-cpus <list>  CPUs of the autoencoder stage. Overrides --affinity\n");
+    printf("  --pipeline                 Server mode only. Overlap the T5, DiT and autoencoder stages of consecutive jobs\n");
+    printf("  --queue-depth <n>          Number of requests buffered between two pipeline stages (default: %zu)\n", config.queue_depth);
+    printf("  --weight-cache <dir>       Store the XNNPack packed weights in <dir> and memory-map them on the next runs\n");
+    printf("  --decode-chunk <n>         Decode the latent in chunks of <n> frames and stream the audio to the output\n");
+    printf("  --decode-overlap <n>       Number of latent frames cross-faded between two decoded chunks (default: %zu)\n", config.decode_overlap);
+    printf("  --segment-overlap <sec>    Overlap of the segments of the clips longer than the model latent (default: %.0f)\n", config.segment_overlap_sec);
+    printf("  --zero-copy                Share the tensor buffers between consecutive stages instead of copying them\n");
+    printf("  --cond-cache <n>           Keep the T5 outputs of the last <n> distinct prompts and reuse them\n");
+    printf("  --cond-cache-dir <dir>     Also store the cached T5 outputs in <dir> and reload them on the next runs\n");
+    printf("  --steps <n>                Number of diffusion steps (default: %zu)\n", request.num_steps);
+    printf("  --sampler <s>              Sampler: ping-pong, euler or dpmpp-2m (default: ping-pong)\n");
+    printf("  --logsnr-start <v>         logSNR of the first step of the sigma schedule (default: %.0f)\n", request.logsnr_start);
+    printf("  --logsnr-end <v>           logSNR of the last step of the sigma schedule (default: %.0f)\n", request.logsnr_end);
+    printf("  --adaptive <threshold>     Extrapolate or skip the DiT steps once the relative change of the denoised estimate is below <threshold>\n");
+    printf("  --format <f>               Sample format of the WAV files: f32, pcm16 or pcm24, with dither (default: f32)\n");
+    printf("  --output <path>            Path of the WAV file, or - to stream it to the standard output (default: output.wav)\n");
+    printf("  --adaptive-check           Also run the full schedule and report the deviation of the adaptive one from it\n");
+    printf("  --sequential-load          Load the models one after another instead of concurrently\n");
+    printf("  --low-memory               Only keep the DiT loaded, and load T5 and the autoencoder when they run\n");
+    printf("  --shared-arena             Release the activations of each stage once it has run, so that the stages share their memory\n");
+    printf("  --huge-pages <mode>        Back the model weights with huge pages: none, thp or hugetlb (default: none)\n");
+    printf("  --numa-bind                Place the weights and the activations of each stage on the NUMA node of its CPUs\n");
+    printf("  --profile <trace.json>     Profile every operator and write a Chrome trace of the generation to <trace.json>\n");
+    printf("  --profile-top <n>          Number of operators listed in the profiling summary (default: 20)\n");
+}
 
-    // Initialize the t5_attnmask_in_data
-    memset(t5_attnmask_in_data, 0, get_num_elems(t5_attnmask_in_dims) * sizeof(int64_t));
-    for(int i = 0; i < ids.size(); i++) {
-        t5_attnmask_in_data[i] = 1;
+// The values are checked by libaudiogen, except the ones only used by the app
+static bool parse_options(int32_t argc, char** argv, int32_t first_arg, AudioGenOptions& options) {
+    audiogen_config& config = options.config;
+    audiogen_request& request = options.request;
+
+    for (int32_t i = first_arg; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool has_value = (i + 1) < argc;
+
+        if (arg == "--length" && has_value) {
+            request.audio_len_sec = std::stof(argv[++i]);
+        } else if (arg == "--batch" && has_value) {
+            options.batch_sz = std::stoull(argv[++i]);
+            if (options.batch_sz == 0) {
+                return false;
+            }
+        } else if (arg == "--t5-threads" && has_value) {
+            config.t5_threads = std::stoull(argv[++i]);
+        } else if (arg == "--dit-threads" && has_value) {
+            config.dit_threads = std::stoull(argv[++i]);
+        } else if (arg == "--autoencoder-threads" && has_value) {
+            config.autoencoder_threads = std::stoull(argv[++i]);
+        } else if (arg == "--t5-precision" && has_value) {
+            config.t5_precision = argv[++i];
+        } else if (arg == "--dit-precision" && has_value) {
+            config.dit_precision = argv[++i];
+        } else if (arg == "--autoencoder-precision" && has_value) {
+            config.autoencoder_precision = argv[++i];
+        } else if (arg == "--affinity" && has_value) {
+            config.affinity = argv[++i];
+        } else if (arg == "--t5-cpus" && has_value) {
+            config.t5_cpus = argv[++i];
+        } else if (arg == "--dit-cpus" && has_value) {
+            config.dit_cpus = argv[++i];
+        } else if (arg == "--autoencoder-cpus" && has_value) {
+            config.autoencoder_cpus = argv[++i];
+        } else if (arg == "--pipeline") {
+            config.pipeline = 1;
+        } else if (arg == "--queue-depth" && has_value) {
+            config.queue_depth = std::stoull(argv[++i]);
+        } else if (arg == "--weight-cache" && has_value) {
+            config.weight_cache_dir = argv[++i];
+        } else if (arg == "--decode-chunk" && has_value) {
+            config.decode_chunk_len = std::stoull(argv[++i]);
+        } else if (arg == "--decode-overlap" && has_value) {
+            config.decode_overlap = std::stoull(argv[++i]);
+        } else if (arg == "--segment-overlap" && has_value) {
+            config.segment_overlap_sec = std::stof(argv[++i]);
+        } else if (arg == "--zero-copy") {
+            config.zero_copy = 1;
+        } else if (arg == "--cond-cache" && has_value) {
+            config.cond_cache_entries = std::stoull(argv[++i]);
+        } else if (arg == "--cond-cache-dir" && has_value) {
+            config.cond_cache_dir = argv[++i];
+        } else if (arg == "--steps" && has_value) {
+            request.num_steps = std::stoull(argv[++i]);
+        } else if (arg == "--sampler" && has_value) {
+            request.sampler = argv[++i];
+        } else if (arg == "--logsnr-start" && has_value) {
+            request.logsnr_start = std::stof(argv[++i]);
+        } else if (arg == "--logsnr-end" && has_value) {
+            request.logsnr_end = std::stof(argv[++i]);
+        } else if (arg == "--adaptive" && has_value) {
+            request.adaptive_threshold = std::stof(argv[++i]);
+            if (request.adaptive_threshold <= 0.0f) {
+                return false;
+            }
+        } else if (arg == "--format" && has_value) {
+            if (!parse_request_format(argv[++i], request.format)) {
+                return false;
+            }
+        } else if (arg == "--output" && has_value) {
+            options.output_path = argv[++i];
+        } else if (arg == "--adaptive-check") {
+            options.adaptive_check = true;
+        } else if (arg == "--sequential-load") {
+            config.parallel_load = 0;
+        } else if (arg == "--low-memory") {
+            config.low_memory = 1;
+        } else if (arg == "--shared-arena") {
+            config.shared_arena = 1;
+        } else if (arg == "--huge-pages" && has_value) {
+            config.huge_pages = argv[++i];
+        } else if (arg == "--numa-bind") {
+            config.numa_bind = 1;
+        } else if (arg == "--profile" && has_value) {
+            options.profile_path = argv[++i];
+            config.profile = 1;
+        } else if (arg == "--profile-top" && has_value) {
+            options.profile_top = std::stoull(argv[++i]);
+        } else {
+            return false;
+        }
     }
+    return true;
+}
 
-    // Initialize the t5_time_in_data
-    memcpy(t5_time_in_data, &k_audio_len_sec, 1 * sizeof(float));
+// Return the reason why a combination of options is invalid for the app, or an empty string.
+// The config and the requests are checked by libaudiogen
+static std::string check_options(const AudioGenOptions& options, bool server_mode, bool has_socket_path) {
+    audiogen_request defaults;
+    audiogen_request_init(&defaults);
+    const audiogen_request& request = options.request;
 
-    auto start_t5 = time_in_ms();
+    if (options.config.pipeline && !server_mode) {
+        return "--pipeline is only available in server mode";
+    }
+    if (server_mode && (request.audio_len_sec != defaults.audio_len_sec || request.num_steps != defaults.num_steps || request.sampler != nullptr ||
+                        request.logsnr_start != defaults.logsnr_start || request.logsnr_end != defaults.logsnr_end)) {
+        return "--length, --steps, --sampler and --logsnr-* are not available in server mode, set them in each job instead";
+    }
+    if (options.adaptive_check && (request.adaptive_threshold == 0.0f || server_mode)) {
+        return "--adaptive-check requires --adaptive, and is not available in server mode";
+    }
+    if (options.adaptive_check && request.format != AUDIOGEN_FORMAT_F32) {
+        // The deviation is measured on the float samples
+        return "--adaptive-check requires --format f32";
+    }
+    if (options.output_path != nullptr && (server_mode || options.batch_sz > 1)) {
+        return "--output is not available in server mode or with --batch, set \"output\" in each job instead";
+    }
+    if (server_mode && request.format != defaults.format) {
+        return "--format is not available in server mode, set it in each job instead";
+    }
+    if (options.profile_path != nullptr && has_socket_path) {
+        // The socket server never returns, so the trace would never be written
+        return "--profile is not available with a socket server";
+    }
+    return "";
+}
 
-    // Run T5
-    AUDIOGEN_CHECK(t5_interpreter->Invoke() == kTfLiteOk);
+// Generate the seed variations of the request of the command line to output_<b>.wav, or to
+// output.wav for a single clip, unless --output sets its path. The audio of each clip is also kept
+// in outputs. Errors are reported to out
+static audiogen_status generate_clips(audiogen_context* context, const AudioGenOptions& options, const char* prompt, uint64_t seed,
+                                      const std::string& suffix, float adaptive_threshold, std::vector<std::vector<uint8_t>>& outputs,
+                                      audiogen_result& result, std::vector<float>& dit_step_ms, FILE* out) {
+    const size_t num_frames = audiogen_get_num_frames(context, options.request.audio_len_sec);
+    const size_t frame_sz = audiogen_get_bytes_per_frame(options.request.format);
+
+    std::vector<audiogen_request> requests(options.batch_sz, options.request);
+    std::vector<AudioGenWavOutput> files(options.batch_sz);
+    outputs.assign(options.batch_sz, std::vector<uint8_t>(num_frames * frame_sz));
+
+    audiogen_status status = AUDIOGEN_OK;
+    for (size_t b = 0; b < requests.size(); ++b) {
+        std::string path = (options.batch_sz > 1 ? "output_" + std::to_string(b) : std::string("output")) + suffix + ".wav";
+        if (options.output_path != nullptr && suffix.empty()) {
+            path = options.output_path;
+        }
+        if (!open_wav_output(path, num_frames, options.request.format, files[b])) {
+            fprintf(out, "ERROR: cannot open %s\n", path.c_str());
+            status = AUDIOGEN_ERROR_INVALID_ARGUMENT;
+            break;
+        }
+
+        requests[b].prompt = prompt;
+        requests[b].seed = seed + b;
+        requests[b].adaptive_threshold = adaptive_threshold;
+        requests[b].output = outputs[b].data();
+        requests[b].output_capacity = num_frames;
+        requests[b].on_audio = write_wav_frames;
+        requests[b].user_data = &files[b];
+    }
 
-    auto end_t5 = time_in_ms();
+    audiogen_handle* handle = nullptr;
+    if (status == AUDIOGEN_OK) {
+        status = audiogen_generate(context, requests.data(), requests.size(), nullptr, nullptr, &handle);
+        if (status == AUDIOGEN_OK) {
+            status = audiogen_wait(handle, &result);
+            if (status != AUDIOGEN_OK) {
+                fprintf(out, "ERROR: %s: %s\n", audiogen_status_string(status), result.error);
+            }
+        } else {
+            fprintf(out, "ERROR: %s: %s\n", audiogen_status_string(status), audiogen_last_error());
+        }
+    }
 
-    // Since the crossattn and global conditioner are constants, we can initialize these 2 inputs
-    // of DiT outside the diffusion for loop
-    memcpy(dit_crossattn_in_data, t5_crossattn_out_data, get_num_elems(dit_crossattn_in_dims) * sizeof(float));
-    memcpy(dit_globalcond_in_data, t5_globalcond_out_data, get_num_elems(dit_globalcond_in_dims) * sizeof(float));
+    for (size_t b = 0; b < files.size(); ++b) {
+        if (!close_wav_output(files[b]) && status == AUDIOGEN_OK) {
+            fprintf(out, "ERROR: cannot write the audio of the clip %zu\n", b);
+            status = AUDIOGEN_ERROR_GENERATION;
+        }
+    }
 
-    auto start_dit = time_in_ms();
+    // The per-step times are only valid until the handle is released
+    if (status == AUDIOGEN_OK) {
+        dit_step_ms.assign(result.timings.dit_step_ms, result.timings.dit_step_ms + result.timings.num_dit_steps);
+    }
+    result.timings.dit_step_ms = nullptr;
+    if (handle != nullptr) {
+        audiogen_release(handle);
+    }
+    return status;
+}
 
-    for(size_t i = 0; i < k_num_steps; ++i) {
-        const float curr_t = t_buffer[i];
-        const float next_t = t_buffer[i + 1];
-        memcpy(dit_t_in_data, &curr_t, 1 * sizeof(float));
+int main(int32_t argc, char** argv) {
 
-        // Run DiT
-        AUDIOGEN_CHECK(dit_interpreter->Invoke() == kTfLiteOk);
+    const bool server_mode = argc >= 4 && std::string(argv[2]) == "--server";
+    const bool has_socket_path = server_mode && argc >= 5 && std::string(argv[4]).rfind("--", 0) != 0;
 
-        // The output of DiT is combined with the current x and t tensors to
-        // generate the next x tensor for DiT
-        sampler_ping_pong(dit_out_data, dit_x_in_data, get_num_elems(dit_x_in_dims), curr_t, next_t, i, seed + i + 4564);
+    if (argc < 5 && !server_mode) {
+        print_usage();
+        return 1;
     }
-    auto end_dit = time_in_ms();
 
-    auto start_autoencoder = time_in_ms();
+    // ----- Parse the cmd line arguments
+    // ----------------------------------
+    const char* models_base_path = argv[1];
+    const size_t num_threads = std::stoull(argv[3]);
 
-    // Initialize the autoencoder's input
-    memcpy(autoencoder_in_data, dit_x_in_data, get_num_elems(dit_x_in_dims) * sizeof(float));
+    AudioGenOptions options;
+    audiogen_config_init(&options.config, num_threads);
+    audiogen_request_init(&options.request);
 
-    // Run AutoEncoder
-    AUDIOGEN_CHECK(autoencoder_interpreter->Invoke() == kTfLiteOk);
+    const int32_t first_option = server_mode ? (has_socket_path ? 5 : 4) : 5;
+    if (!parse_options(argc, argv, first_option, options)) {
+        print_usage();
+        return 1;
+    }
 
-    auto end_autoencoder = time_in_ms();
+    const std::string options_error = check_options(options, server_mode, has_socket_path);
+    if (!options_error.empty()) {
+        printf("ERROR: %s\n", options_error.c_str());
+        return 1;
+    }
 
-    const size_t num_audio_samples = get_num_elems(autoencoder_out_dims) / 2;
-    const float* left_ch = autoencoder_out_data;
-    const float* right_ch = autoencoder_out_data + num_audio_samples;
+    auto start_load = time_in_ms();
 
-    save_as_wav(output_path.c_str(), left_ch, right_ch, num_audio_samples);
+    audiogen_context* context = nullptr;
+    const audiogen_status create_status = audiogen_create(models_base_path, &options.config, &context);
+    if (create_status != AUDIOGEN_OK) {
+        printf("ERROR: %s: %s\n", audiogen_status_string(create_status), audiogen_last_error());
+        return 1;
+    }
 
-    // Save the file
-    auto t5_exec_time          = (end_t5 - start_t5);
-    auto dit_exec_time         = (end_dit - start_dit);
-    auto dit_avg_step_time     = (dit_exec_time / static_cast<float>(k_num_steps));
-    auto autoencoder_exec_time = (end_autoencoder - start_autoencoder);
-    auto total_exec_time       = t5_exec_time + dit_exec_time + autoencoder_exec_time;
+    auto end_load = time_in_ms();
+
+    // In server mode, the standard output is reserved to the job answers, and with --output - to the audio
+    const bool stdout_reserved = server_mode || (options.output_path != nullptr && std::string(options.output_path) == "-");
+    FILE* report_out = stdout_reserved ? stderr : stdout;
+    audiogen_print_startup_report(context, report_out);
+    fprintf(report_out, "Models loaded in %ld ms\n", end_load - start_load);
+
+    int32_t exit_code = 0;
+
+    if (server_mode) {
+        const bool pipeline = options.config.pipeline != 0;
+        if (has_socket_path) {
+            run_server_socket(context, pipeline, argv[4]);
+            exit_code = 1;
+        } else {
+            run_server_stdin(context, pipeline);
+        }
+    } else {
+        const bool long_form = options.request.audio_len_sec > audiogen_get_max_audio_len_sec(context);
+        if (long_form && options.adaptive_check) {
+            fprintf(report_out, "ERROR: --adaptive-check is not available for long-form audio\n");
+            audiogen_destroy(context);
+            return 1;
+        }
+
+        const char* prompt = argv[2];
+        const uint64_t seed = std::stoull(argv[4]);
+        std::vector<std::vector<uint8_t>> outputs;
+        audiogen_result result{};
+
+        // The full schedule runs first, to the <output>_full.wav files, and its audio is kept
+        std::vector<std::vector<uint8_t>> full_outputs;
+        if (options.adaptive_check) {
+            audiogen_result full_result{};
+            std::vector<float> full_step_ms;
+            if (generate_clips(context, options, prompt, seed, "_full", 0.0f, full_outputs, full_result, full_step_ms, report_out) != AUDIOGEN_OK) {
+                audiogen_destroy(context);
+                return 1;
+            }
+            fprintf(report_out, "Full schedule: DiT %ld ms, total %ld ms\n", full_result.timings.dit_ms, full_result.timings.total_ms);
+        }
+
+        std::vector<float> dit_step_ms;
+        if (generate_clips(context, options, prompt, seed, "", options.request.adaptive_threshold, outputs, result, dit_step_ms, report_out) != AUDIOGEN_OK) {
+            audiogen_destroy(context);
+            return 1;
+        }
+        const audiogen_timings& timings = result.timings;
+
+        fprintf(report_out, "T5: %ld ms\n", timings.t5_ms);
+        fprintf(report_out, "DiT: %ld ms\n", timings.dit_ms);
+        fprintf(report_out, "DiT Avg per step: %f ms\n", timings.dit_avg_step_ms);
+        fprintf(report_out, "DiT steps (%s):", options.request.sampler != nullptr ? options.request.sampler : "ping-pong");
+        for (size_t i = 0; i < dit_step_ms.size(); ++i) {
+            fprintf(report_out, "%s %.1f", i == 0 ? "" : ",", dit_step_ms[i]);
+        }
+        fprintf(report_out, " ms\n");
+        fprintf(report_out, "Autoencoder: %ld ms\n", timings.autoencoder_ms);
+        if (options.config.low_memory) {
+            fprintf(report_out, "Stage loading: %ld ms\n", timings.load_ms);
+        }
+        fprintf(report_out, "Output: %s, %zu bytes per clip, %ld ms\n", get_sample_format_name(static_cast<AudioGenSampleFormat>(options.request.format)),
+                result.num_frames * audiogen_get_bytes_per_frame(options.request.format), timings.output_ms);
+        fprintf(report_out, "Total run time: %ld ms\n", timings.total_ms);
+        fprintf(report_out, "Time to first sample: %ld ms\n", timings.first_sample_ms);
+
+        if (options.request.adaptive_threshold > 0.0f) {
+            fprintf(report_out, "Adaptive: %zu DiT steps run, %zu saved\n", timings.dit_steps_run, timings.dit_steps_saved);
+        }
+        if (options.adaptive_check) {
+            float deviation = 0.0f;
+            for (size_t b = 0; b < outputs.size(); ++b) {
+                deviation = std::max(deviation, get_relative_deviation(full_outputs[b], outputs[b]));
+            }
+            fprintf(report_out, "Adaptive deviation from the full schedule: %.3f%% of the audio norm (SNR %.1f dB)\n",
+                    100.0f * deviation, -20.0f * std::log10(deviation));
+        }
+
+        if (timings.peak_rss_dit_kb > 0) {
+            fprintf(report_out, "Peak RSS: T5 %zu MB, DiT %zu MB, Autoencoder %zu MB, after the generation %zu MB\n",
+                    timings.peak_rss_t5_kb / 1024, timings.peak_rss_dit_kb / 1024, timings.peak_rss_autoencoder_kb / 1024, timings.idle_rss_kb / 1024);
+        }
+
+        audiogen_print_stats(context, report_out);
+
+        if (long_form) {
+            fprintf(report_out, "Long-form: %zu segments\n", result.num_segments);
+        }
+
+        if (options.batch_sz > 1) {
+            fprintf(report_out, "Batch: %zu clips, %f clips/s\n", options.batch_sz, options.batch_sz * 1000.0f / timings.total_ms);
+        }
+    }
 
-    printf("T5: %ld ms\n", t5_exec_time);
-    printf("DiT: %ld ms\n", dit_exec_time);
-    printf("DiT Avg per step: %f ms\n", dit_avg_step_time);
-    printf("Autoencoder: %ld ms\n", autoencoder_exec_time);
-    printf("Total run time: %ld ms\n", total_exec_time);
+    if (options.profile_path != nullptr) {
+        if (audiogen_write_profile(context, options.profile_path, options.profile_top, report_out) == AUDIOGEN_OK) {
+            fprintf(report_out, "Profile written to %s\n", options.profile_path);
+        } else {
+            fprintf(report_out, "ERROR: %s\n", audiogen_last_error());
+            exit_code = 1;
+        }
+    }
 
-    return 0;
+    audiogen_destroy(context);
+    return exit_code;
 }
@@ -0,0 +1,836 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Arm Limited and/or its
+ * affiliates <open-source-office@arm.com>
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// End-to-end latency benchmark of the audiogen app. For each number of threads, the models are
+// loaded again and the first generation is reported on its own ("cold"), since it includes the
+// one-off costs of the first Invoke of each interpreter. The following generations run a number
+// of warm-up iterations, then the measured iterations ("warm") for each number of steps and
+// each sampler. The "dit_step" stage is the average time of a step, DiT call and sampler included.
+//
+// With several precision configurations, the output of each configuration is also compared with
+// the output of the first one, for the same seed, number of threads, number of steps and sampler. The
+// difference is reported as a signal-to-noise ratio, in dB, next to the latency.
+//
+// With several placement policies, each configuration is also measured with the stages pinned
+// to the CPU clusters of each policy.
+//
+// With several huge-page modes, each configuration is also measured with the model weights backed
+// by the pages of each mode, which mostly shows in the "dit_step" stage.
+//
+// The golden mode checks a change against reference outputs recorded before it. --golden-record
+// generates a clip with the first seed, number of steps, sampler, precision configuration and
+// number of threads, and stores the T5 outputs, the latent after each DiT step, the audio and the
+// p50 latency of each stage. --golden-check generates the same clip, and fails when the output of a
+// stage boundary differs from the reference by more than --min-snr, or when a stage is slower than
+// the baseline by more than --max-regression.
+
+#include "audiogen_core.h"
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <tuple>
+
+constexpr const char* k_default_prompt = "warm arpeggios on house beats 120BPM with drums effect";
+
+struct BenchOptions {
+    std::string models_base_path;
+    std::string prompt = k_default_prompt;
+    size_t seed = 99;
+    std::vector<size_t> threads = {std::max(1u, std::thread::hardware_concurrency())};
+    std::vector<size_t> steps = {k_num_steps};
+    std::vector<AudioGenSampler> samplers = {AudioGenSampler::ping_pong};
+    std::vector<AudioGenPrecisions> precisions = {AudioGenPrecisions()};
+    std::vector<std::string> affinity_policies = {"none"};
+    std::vector<AudioGenHugePages> huge_pages = {AudioGenHugePages::none};
+    bool numa_bind = false;
+    size_t warmup = 2;
+    size_t iterations = 10;
+    std::string weight_cache_dir;
+    std::string output_path = "audiogen_bench.wav";
+    std::string csv_path;
+    std::string json_path;
+
+    // Golden mode, see above
+    std::string golden_record_dir;
+    std::string golden_check_dir;
+    double min_snr_db = 40.0;
+    double max_regression_pct = 10.0;
+};
+
+// Latency statistics of one stage, in ms, for one configuration
+struct BenchRow {
+    std::string precision;
+    std::string affinity;
+    std::string pages;
+    size_t threads = 0;
+    size_t steps = 0;
+    std::string sampler;
+    std::string phase;
+    std::string stage;
+    size_t count = 0;
+    double mean = 0.0;
+    double min = 0.0;
+    double p50 = 0.0;
+    double p90 = 0.0;
+    double p99 = 0.0;
+    double max = 0.0;
+    // SNR of the output against the first precision configuration, on the warm total rows
+    double snr_db = NAN;
+};
+
+static std::vector<double> get_stage_values(const std::vector<AudioGenTimings>& runs, const std::string& stage) {
+    std::vector<double> values;
+    for (const AudioGenTimings& t : runs) {
+        if (stage == "tokenizer") {
+            values.push_back(t.tokenizer);
+        } else if (stage == "t5") {
+            values.push_back(t.t5);
+        } else if (stage == "dit") {
+            values.push_back(t.dit);
+        } else if (stage == "dit_step") {
+            values.push_back(t.dit_avg_step);
+        } else if (stage == "autoencoder") {
+            values.push_back(t.autoencoder);
+        } else if (stage == "save") {
+            values.push_back(t.save);
+        } else {
+            values.push_back(t.total);
+        }
+    }
+    return values;
+}
+
+// Nearest-rank percentile of sorted values
+static double get_percentile(const std::vector<double>& sorted_values, double percentile) {
+    const size_t rank = static_cast<size_t>(std::ceil(percentile / 100.0 * sorted_values.size()));
+    return sorted_values[std::min(sorted_values.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+static BenchRow make_row(const std::string& precision, const std::string& affinity, const std::string& pages, size_t threads, size_t steps,
+                         const std::string& sampler, const std::string& phase, const std::string& stage, std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+
+    BenchRow row;
+    row.precision = precision;
+    row.affinity = affinity;
+    row.pages = pages;
+    row.threads = threads;
+    row.steps = steps;
+    row.sampler = sampler;
+    row.phase = phase;
+    row.stage = stage;
+    row.count = values.size();
+    for (double v : values) {
+        row.mean += v;
+    }
+    row.mean /= values.size();
+    row.min = values.front();
+    row.p50 = get_percentile(values, 50.0);
+    row.p90 = get_percentile(values, 90.0);
+    row.p99 = get_percentile(values, 99.0);
+    row.max = values.back();
+    return row;
+}
+
+static void add_rows(std::vector<BenchRow>& rows, const std::string& precision, const std::string& affinity, const std::string& pages, size_t threads,
+                     size_t steps, const std::string& sampler, const std::string& phase, const std::vector<AudioGenTimings>& runs) {
+    for (const char* stage : {"tokenizer", "t5", "dit", "dit_step", "autoencoder", "save", "total"}) {
+        rows.push_back(make_row(precision, affinity, pages, threads, steps, sampler, phase, stage, get_stage_values(runs, stage)));
+    }
+}
+
+// Precisions of the T5, DiT and autoencoder stages, like fp32/int8/fp16
+static std::string get_precisions_name(const AudioGenPrecisions& precisions) {
+    return std::string(get_precision_name(precisions.t5)) + "/" + get_precision_name(precisions.dit) + "/" +
+           get_precision_name(precisions.autoencoder);
+}
+
+static bool parse_precisions(const std::string& s, AudioGenPrecisions& precisions) {
+    std::vector<std::string> names;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, '/')) {
+        names.push_back(item);
+    }
+    return names.size() == 3 && parse_precision(names[0], precisions.t5) && parse_precision(names[1], precisions.dit) &&
+           parse_precision(names[2], precisions.autoencoder);
+}
+
+// Interleaved samples of a WAV file written by the app: a 44-byte header followed by 32-bit floats
+static std::vector<float> read_wav_samples(const std::string& path) {
+    std::ifstream in_file(path, std::ios::binary);
+    AUDIOGEN_CHECK(in_file.is_open());
+
+    constexpr size_t header_sz = 44;
+    int32_t data_chunk_sz = 0;
+    in_file.seekg(header_sz - sizeof(data_chunk_sz));
+    in_file.read(reinterpret_cast<char*>(&data_chunk_sz), sizeof(data_chunk_sz));
+
+    std::vector<float> samples(data_chunk_sz / sizeof(float));
+    in_file.read(reinterpret_cast<char*>(samples.data()), samples.size() * sizeof(float));
+    AUDIOGEN_CHECK(in_file.good());
+    return samples;
+}
+
+// Signal-to-noise ratio of test against ref, in dB. It is infinite when both are identical
+static double get_snr_db(const std::vector<float>& ref, const std::vector<float>& test) {
+    AUDIOGEN_CHECK(ref.size() == test.size());
+    double signal = 0.0;
+    double noise = 0.0;
+    for (size_t i = 0; i < ref.size(); ++i) {
+        const double diff = static_cast<double>(ref[i]) - test[i];
+        signal += static_cast<double>(ref[i]) * ref[i];
+        noise += diff * diff;
+    }
+    return noise > 0.0 ? 10.0 * std::log10(signal / noise) : INFINITY;
+}
+
+// Name of the CPU, for comparing the results of different machines
+static std::string get_cpu_name() {
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    std::string cpu_part;
+    while (std::getline(cpuinfo, line)) {
+        const size_t colon = line.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        const std::string key = line.substr(0, line.find_last_not_of(" \t", colon - 1) + 1);
+        const std::string value = colon + 2 <= line.size() ? line.substr(colon + 2) : "";
+        if (key == "model name" || key == "Hardware") {
+            return value;
+        }
+        if (key == "CPU part" && cpu_part.empty()) {
+            cpu_part = "CPU part " + value;
+        }
+    }
+    return cpu_part.empty() ? "unknown" : cpu_part;
+}
+
+static std::string json_escape(const std::string& s) {
+    std::string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out;
+}
+
+static void write_csv(const std::string& path, const std::vector<BenchRow>& rows) {
+    std::ofstream out_file(path);
+    AUDIOGEN_CHECK(out_file.is_open());
+
+    out_file << "precision,affinity,pages,threads,steps,sampler,phase,stage,count,mean_ms,min_ms,p50_ms,p90_ms,p99_ms,max_ms,snr_db\n";
+    for (const BenchRow& row : rows) {
+        out_file << row.precision << "," << row.affinity << "," << row.pages << "," << row.threads << "," << row.steps << "," << row.sampler << "," << row.phase << "," << row.stage << "," << row.count << ","
+                 << row.mean << "," << row.min << "," << row.p50 << "," << row.p90 << "," << row.p99 << "," << row.max << ",";
+        if (!std::isnan(row.snr_db)) {
+            out_file << row.snr_db;
+        }
+        out_file << "\n";
+    }
+}
+
+static void write_json(const std::string& path, const BenchOptions& options, const std::vector<BenchRow>& rows) {
+    std::ofstream out_file(path);
+    AUDIOGEN_CHECK(out_file.is_open());
+
+    out_file << "{\n  \"cpu\": \"" << json_escape(get_cpu_name()) << "\",\n"
+             << "  \"hardware_concurrency\": " << std::thread::hardware_concurrency() << ",\n"
+             << "  \"prompt\": \"" << json_escape(options.prompt) << "\",\n"
+             << "  \"seed\": " << options.seed << ",\n"
+             << "  \"warmup\": " << options.warmup << ",\n"
+             << "  \"iterations\": " << options.iterations << ",\n"
+             << "  \"numa_bind\": " << (options.numa_bind ? "true" : "false") << ",\n"
+             << "  \"results\": [\n";
+    for (size_t i = 0; i < rows.size(); ++i) {
+        const BenchRow& row = rows[i];
+        // JSON has no infinity, so an output identical to the reference is reported as "inf"
+        std::string snr_db = "null";
+        if (std::isinf(row.snr_db)) {
+            snr_db = "\"inf\"";
+        } else if (!std::isnan(row.snr_db)) {
+            snr_db = std::to_string(row.snr_db);
+        }
+        out_file << "    {\"precision\": \"" << row.precision << "\", \"affinity\": \"" << row.affinity << "\", \"pages\": \"" << row.pages << "\", \"threads\": " << row.threads << ", \"steps\": " << row.steps
+                 << ", \"sampler\": \"" << row.sampler << "\", \"phase\": \"" << row.phase << "\", \"stage\": \"" << row.stage << "\", \"count\": " << row.count
+                 << ", \"mean_ms\": " << row.mean << ", \"min_ms\": " << row.min << ", \"p50_ms\": " << row.p50
+                 << ", \"p90_ms\": " << row.p90 << ", \"p99_ms\": " << row.p99 << ", \"max_ms\": " << row.max << ", \"snr_db\": " << snr_db << "}"
+                 << (i + 1 < rows.size() ? ",\n" : "\n");
+    }
+    out_file << "  ]\n}\n";
+}
+
+static void print_rows(const std::vector<BenchRow>& rows) {
+    printf("%-14s %-8s %-7s %8s %6s %-9s %6s %-12s %6s %10s %10s %10s %10s %10s %10s\n",
+           "Precision", "Affinity", "Pages", "Threads", "Steps", "Sampler", "Phase", "Stage", "Count", "Mean (ms)", "p50", "p90", "p99", "Max", "SNR (dB)");
+    for (const BenchRow& row : rows) {
+        printf("%-14s %-8s %-7s %8zu %6zu %-9s %6s %-12s %6zu %10.1f %10.1f %10.1f %10.1f %10.1f",
+               row.precision.c_str(), row.affinity.c_str(), row.pages.c_str(), row.threads, row.steps, row.sampler.c_str(), row.phase.c_str(), row.stage.c_str(), row.count, row.mean, row.p50, row.p90, row.p99, row.max);
+        if (!std::isnan(row.snr_db)) {
+            printf(" %10.1f", row.snr_db);
+        }
+        printf("\n");
+    }
+}
+
+static std::vector<size_t> parse_list(const std::string& s) {
+    std::vector<size_t> values;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        values.push_back(std::stoull(item));
+    }
+    return values;
+}
+
+static void print_usage() {
+    printf("ERROR: Usage ./audiogen_bench <models_base_path> [options]\n");
+    printf("Options:\n");
+    printf("  --threads <n,...>     Numbers of threads to benchmark (default: number of CPUs)\n");
+    printf("  --steps <n,...>       Numbers of DiT steps to benchmark (default: %zu)\n", k_num_steps);
+    printf("  --samplers <s,...>    Samplers to benchmark: ping-pong, euler or dpmpp-2m (default: ping-pong)\n");
+    printf("  --precisions <t5/dit/autoencoder,...>\n");
+    printf("                        Precision configurations to benchmark, like fp32/int8/fp16. The output of each\n");
+    printf("                        configuration is compared with the output of the first one (default: fp32/int8/fp16)\n");
+    printf("  --affinity <policy,...>\n");
+    printf("                        Placement policies to benchmark: none, little, big or prime (default: none)\n");
+    printf("  --huge-pages <mode,...>\n");
+    printf("                        Pages of the model weights to benchmark: none, thp or hugetlb (default: none)\n");
+    printf("  --numa-bind           Place the weights and the activations of each stage on the NUMA node of its CPUs\n");
+    printf("  --warmup <n>          Number of warm-up generations per configuration (default: 2)\n");
+    printf("  --iterations <n>      Number of measured generations per configuration (default: 10)\n");
+    printf("  --prompt <prompt>     Prompt of the generations\n");
+    printf("  --seed <n>            Seed of the generations (default: 99)\n");
+    printf("  --weight-cache <dir>  Store the XNNPack packed weights in <dir> and memory-map them on the next loads\n");
+    printf("  --output <path>       Path of the generated audio (default: audiogen_bench.wav)\n");
+    printf("  --csv <path>          Write the results as CSV to <path>\n");
+    printf("  --json <path>         Write the results as JSON to <path>\n");
+    printf("  --golden-record <dir> Store the outputs of each stage boundary and the latency of each stage in <dir>\n");
+    printf("  --golden-check <dir>  Compare the outputs and the latency with the ones stored in <dir>, and fail on a difference\n");
+    printf("  --min-snr <dB>        Lowest signal-to-noise ratio of an output against its reference (default: 40)\n");
+    printf("  --max-regression <%%>  Largest latency increase of a stage over its baseline (default: 10)\n");
+}
+
+static bool parse_options(int32_t argc, char** argv, BenchOptions& options) {
+    if (argc < 2) {
+        return false;
+    }
+    options.models_base_path = argv[1];
+
+    for (int32_t i = 2; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool has_value = (i + 1) < argc;
+
+        if (arg == "--threads" && has_value) {
+            options.threads = parse_list(argv[++i]);
+        } else if (arg == "--steps" && has_value) {
+            options.steps = parse_list(argv[++i]);
+        } else if (arg == "--samplers" && has_value) {
+            options.samplers.clear();
+            std::stringstream ss(argv[++i]);
+            std::string item;
+            while (std::getline(ss, item, ',')) {
+                options.samplers.emplace_back();
+                if (!parse_sampler(item, options.samplers.back())) {
+                    return false;
+                }
+            }
+            if (options.samplers.empty()) {
+                return false;
+            }
+        } else if (arg == "--precisions" && has_value) {
+            options.precisions.clear();
+            std::stringstream ss(argv[++i]);
+            std::string item;
+            while (std::getline(ss, item, ',')) {
+                options.precisions.emplace_back();
+                if (!parse_precisions(item, options.precisions.back())) {
+                    return false;
+                }
+            }
+            if (options.precisions.empty()) {
+                return false;
+            }
+        } else if (arg == "--affinity" && has_value) {
+            options.affinity_policies.clear();
+            std::stringstream ss(argv[++i]);
+            std::string item;
+            while (std::getline(ss, item, ',')) {
+                AudioGenAffinity affinity;
+                if (!get_policy_affinity(item, {AudioGenCpuCluster()}, affinity)) {
+                    return false;
+                }
+                options.affinity_policies.push_back(item);
+            }
+            if (options.affinity_policies.empty()) {
+                return false;
+            }
+        } else if (arg == "--huge-pages" && has_value) {
+            options.huge_pages.clear();
+            std::stringstream ss(argv[++i]);
+            std::string item;
+            while (std::getline(ss, item, ',')) {
+                options.huge_pages.emplace_back();
+                if (!parse_huge_pages(item, options.huge_pages.back())) {
+                    return false;
+                }
+            }
+            if (options.huge_pages.empty()) {
+                return false;
+            }
+        } else if (arg == "--numa-bind") {
+            options.numa_bind = true;
+        } else if (arg == "--warmup" && has_value) {
+            options.warmup = std::stoull(argv[++i]);
+        } else if (arg == "--iterations" && has_value) {
+            options.iterations = std::stoull(argv[++i]);
+        } else if (arg == "--prompt" && has_value) {
+            options.prompt = argv[++i];
+        } else if (arg == "--seed" && has_value) {
+            options.seed = std::stoull(argv[++i]);
+        } else if (arg == "--weight-cache" && has_value) {
+            options.weight_cache_dir = argv[++i];
+        } else if (arg == "--output" && has_value) {
+            options.output_path = argv[++i];
+        } else if (arg == "--csv" && has_value) {
+            options.csv_path = argv[++i];
+        } else if (arg == "--json" && has_value) {
+            options.json_path = argv[++i];
+        } else if (arg == "--golden-record" && has_value) {
+            options.golden_record_dir = argv[++i];
+        } else if (arg == "--golden-check" && has_value) {
+            options.golden_check_dir = argv[++i];
+        } else if (arg == "--min-snr" && has_value) {
+            options.min_snr_db = std::stod(argv[++i]);
+        } else if (arg == "--max-regression" && has_value) {
+            options.max_regression_pct = std::stod(argv[++i]);
+        } else {
+            return false;
+        }
+    }
+
+    const auto has_zero = [](const std::vector<size_t>& v) { return v.empty() || std::count(v.begin(), v.end(), 0) > 0; };
+    const bool one_golden_mode = options.golden_record_dir.empty() || options.golden_check_dir.empty();
+    return !has_zero(options.threads) && !has_zero(options.steps) && options.iterations > 0 && one_golden_mode;
+}
+
+static int32_t run_bench(const BenchOptions& options) {
+    printf("CPU: %s, %u hardware threads\n", get_cpu_name().c_str(), std::thread::hardware_concurrency());
+
+    const std::vector<AudioGenCpuCluster> clusters = get_cpu_clusters();
+    printf("CPU clusters:");
+    for (const AudioGenCpuCluster& cluster : clusters) {
+        printf(" [%s] capacity %zu", format_cpu_list(cluster.cpus).c_str(), cluster.capacity);
+    }
+    printf("\n");
+
+    std::vector<BenchRow> rows;
+
+    // Output of the first precision configuration, for each number of threads, number of steps and sampler
+    std::map<std::tuple<size_t, size_t, AudioGenSampler>, std::vector<float>> ref_samples;
+
+    for (const AudioGenPrecisions& precisions : options.precisions) {
+        const std::string precision = get_precisions_name(precisions);
+
+        for (const std::string& affinity_policy : options.affinity_policies) {
+            // Without a policy, the stages are pinned to all the CPUs, since this thread keeps the
+            // affinity of the last stage of the previous configuration
+            AudioGenAffinity affinity;
+            if (affinity_policy == "none") {
+                std::vector<int32_t> all_cpus;
+                for (const AudioGenCpuCluster& cluster : clusters) {
+                    all_cpus.insert(all_cpus.end(), cluster.cpus.begin(), cluster.cpus.end());
+                }
+                std::sort(all_cpus.begin(), all_cpus.end());
+                affinity = {all_cpus, all_cpus, all_cpus};
+            } else if (!get_policy_affinity(affinity_policy, clusters, affinity)) {
+                printf("ERROR: unknown affinity policy %s\n", affinity_policy.c_str());
+                return 1;
+            }
+
+            for (size_t num_threads : options.threads) {
+                for (AudioGenHugePages huge_pages : options.huge_pages) {
+                    AudioGenConfig config;
+                    config.precisions = precisions;
+                    config.affinity = affinity;
+                    config.threads.t5 = num_threads;
+                    config.threads.dit = num_threads;
+                    config.threads.autoencoder = num_threads;
+                    config.weight_cache_dir = options.weight_cache_dir;
+                    config.huge_pages = huge_pages;
+                    config.numa_bind = options.numa_bind;
+                    const std::string pages = get_huge_pages_name(huge_pages);
+
+                    auto models = std::make_unique<AudioGenModels>();
+
+                    auto start_load = time_in_ms();
+                    load_models(*models, options.models_base_path, config);
+                    auto end_load = time_in_ms();
+
+                    // The start-up report shows the pages and the NUMA node of each stage
+                    if (huge_pages != AudioGenHugePages::none || options.numa_bind) {
+                        print_startup_report(stderr, models->startup);
+                    }
+
+                    rows.push_back(make_row(precision, affinity_policy, pages, num_threads, 0, "", "cold", "load", {static_cast<double>(end_load - start_load)}));
+
+                    std::vector<AudioGenJob> jobs(1);
+                    jobs[0].prompt = options.prompt;
+                    jobs[0].seed = options.seed;
+                    jobs[0].output_path = options.output_path;
+
+                    // The first Invoke of each interpreter includes one-off costs, like the first
+                    // allocations of XNNPack, so it is reported separately
+                    jobs[0].num_steps = options.steps[0];
+                    jobs[0].sampler = options.samplers[0];
+                    add_rows(rows, precision, affinity_policy, pages, num_threads, options.steps[0], get_sampler_name(options.samplers[0]), "cold",
+                             {generate_audio_batch(*models, jobs)});
+
+                    for (size_t num_steps : options.steps) {
+                        for (AudioGenSampler sampler : options.samplers) {
+                            const std::string sampler_name = get_sampler_name(sampler);
+                            jobs[0].num_steps = num_steps;
+                            jobs[0].sampler = sampler;
+
+                            for (size_t i = 0; i < options.warmup; ++i) {
+                                generate_audio_batch(*models, jobs);
+                            }
+
+                            std::vector<AudioGenTimings> runs;
+                            for (size_t i = 0; i < options.iterations; ++i) {
+                                runs.push_back(generate_audio_batch(*models, jobs));
+                            }
+                            add_rows(rows, precision, affinity_policy, pages, num_threads, num_steps, sampler_name, "warm", runs);
+
+                            // The first configuration is the reference of the following ones
+                            const std::vector<float> samples = read_wav_samples(options.output_path);
+                            const auto ref = ref_samples.emplace(std::make_tuple(num_threads, num_steps, sampler), samples);
+                            if (!ref.second) {
+                                rows.back().snr_db = get_snr_db(ref.first->second, samples);
+                            }
+
+                            // The rows of a run end with dit_step, autoencoder, save and total
+                            fprintf(stderr, "Precision: %s, affinity: %s, pages: %s, threads: %zu, steps: %zu, sampler: %s, dit_step p50: %.1f ms, total p50: %.1f ms\n",
+                                    precision.c_str(), affinity_policy.c_str(), pages.c_str(), num_threads, num_steps, sampler_name.c_str(),
+                                    rows[rows.size() - 4].p50, rows.back().p50);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    print_rows(rows);
+
+    if (!options.csv_path.empty()) {
+        write_csv(options.csv_path, rows);
+    }
+    if (!options.json_path.empty()) {
+        write_json(options.json_path, options, rows);
+    }
+
+    return 0;
+}
+
+// ----- Golden mode
+// ----------------------------------
+// Stages whose p50 latency is compared with the baseline
+constexpr const char* k_golden_stages[] = {"t5", "dit", "dit_step", "autoencoder", "total"};
+
+// Slack added to the regression threshold, since the stages are timed in ms
+constexpr double k_golden_latency_slack_ms = 1.0;
+
+// Generation of the golden mode, and p50 latency of each stage, stored in <dir>/golden.txt
+// as one "<key> <value>" line per field
+struct GoldenConfig {
+    std::string prompt;
+    size_t seed = 0;
+    size_t steps = 0;
+    AudioGenSampler sampler = AudioGenSampler::ping_pong;
+    AudioGenPrecisions precisions;
+    size_t threads = 0;
+    std::map<std::string, double> p50_ms;
+};
+
+// Outputs of the stage boundaries of a generation
+struct GoldenOutputs {
+    std::vector<float> crossattn;
+    std::vector<float> globalcond;
+    std::vector<std::vector<float>> dit_steps;
+    // Interleaved stereo samples
+    std::vector<float> audio;
+};
+
+static std::string get_golden_path(const std::string& dir, const std::string& name) {
+    return dir + "/" + name;
+}
+
+static std::string get_dit_step_name(size_t step) {
+    char name[32];
+    snprintf(name, sizeof(name), "dit_step_%02zu.f32", step);
+    return name;
+}
+
+static void write_floats(const std::string& path, const std::vector<float>& values) {
+    std::ofstream out_file(path, std::ios::binary);
+    AUDIOGEN_CHECK(out_file.is_open());
+    out_file.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(float));
+    AUDIOGEN_CHECK(out_file.good());
+}
+
+static std::vector<float> read_floats(const std::string& path) {
+    std::ifstream in_file(path, std::ios::binary | std::ios::ate);
+    if (!in_file.is_open()) {
+        fprintf(stderr, "ERROR: cannot open the reference %s\n", path.c_str());
+        AUDIOGEN_CHECK(false && "missing golden reference");
+    }
+    std::vector<float> values(static_cast<size_t>(in_file.tellg()) / sizeof(float));
+    in_file.seekg(0);
+    in_file.read(reinterpret_cast<char*>(values.data()), values.size() * sizeof(float));
+    AUDIOGEN_CHECK(in_file.good());
+    return values;
+}
+
+static void write_golden_config(const std::string& path, const GoldenConfig& config) {
+    std::ofstream out_file(path);
+    AUDIOGEN_CHECK(out_file.is_open());
+    out_file << "prompt " << config.prompt << "\n"
+             << "seed " << config.seed << "\n"
+             << "steps " << config.steps << "\n"
+             << "sampler " << get_sampler_name(config.sampler) << "\n"
+             << "precisions " << get_precisions_name(config.precisions) << "\n"
+             << "threads " << config.threads << "\n";
+    for (const auto& p50 : config.p50_ms) {
+        out_file << "p50_ms." << p50.first << " " << p50.second << "\n";
+    }
+}
+
+static GoldenConfig read_golden_config(const std::string& path) {
+    std::ifstream in_file(path);
+    if (!in_file.is_open()) {
+        fprintf(stderr, "ERROR: cannot open %s, record it with --golden-record\n", path.c_str());
+        AUDIOGEN_CHECK(false && "missing golden config");
+    }
+
+    GoldenConfig config;
+    std::string line;
+    while (std::getline(in_file, line)) {
+        const size_t space = line.find(' ');
+        if (space == std::string::npos) {
+            continue;
+        }
+        const std::string key = line.substr(0, space);
+        const std::string value = line.substr(space + 1);
+        if (key == "prompt") {
+            config.prompt = value;
+        } else if (key == "seed") {
+            config.seed = std::stoull(value);
+        } else if (key == "steps") {
+            config.steps = std::stoull(value);
+        } else if (key == "sampler") {
+            AUDIOGEN_CHECK(parse_sampler(value, config.sampler));
+        } else if (key == "precisions") {
+            AUDIOGEN_CHECK(parse_precisions(value, config.precisions));
+        } else if (key == "threads") {
+            config.threads = std::stoull(value);
+        } else if (key.compare(0, 7, "p50_ms.") == 0) {
+            config.p50_ms[key.substr(7)] = std::stod(value);
+        }
+    }
+    AUDIOGEN_CHECK(config.steps > 0 && config.threads > 0);
+    return config;
+}
+
+static std::unique_ptr<AudioGenModels> load_golden_models(const std::string& models_base_path, const GoldenConfig& golden) {
+    AudioGenConfig config;
+    config.precisions = golden.precisions;
+    config.threads.t5 = golden.threads;
+    config.threads.dit = golden.threads;
+    config.threads.autoencoder = golden.threads;
+
+    auto models = std::make_unique<AudioGenModels>();
+    load_models(*models, models_base_path, config);
+    return models;
+}
+
+static AudioGenJob make_golden_job(const GoldenConfig& golden, const std::string& output_path) {
+    AudioGenJob job;
+    job.prompt = golden.prompt;
+    job.seed = golden.seed;
+    job.num_steps = golden.steps;
+    job.sampler = golden.sampler;
+    job.output_path = output_path;
+    return job;
+}
+
+// Generate the golden clip with observers on the stage boundaries. The observers slow the stages
+// down, so the latency is measured by other generations
+static GoldenOutputs capture_golden_outputs(AudioGenModels& models, const AudioGenJob& golden_job) {
+    GoldenOutputs outputs;
+    std::vector<AudioGenJob> jobs = {golden_job};
+    AudioGenJobObserver& observer = jobs[0].observer;
+    observer.on_conditioning = [&outputs](const float* crossattn, size_t crossattn_sz, const float* globalcond, size_t globalcond_sz) {
+        outputs.crossattn.assign(crossattn, crossattn + crossattn_sz);
+        outputs.globalcond.assign(globalcond, globalcond + globalcond_sz);
+    };
+    observer.on_dit_step = [&outputs](size_t, const float* x, size_t x_sz) {
+        outputs.dit_steps.emplace_back(x, x + x_sz);
+    };
+    jobs[0].write_audio = [&outputs](const float* left_ch, const float* right_ch, size_t num_samples) {
+        for (size_t i = 0; i < num_samples; ++i) {
+            outputs.audio.push_back(left_ch[i]);
+            outputs.audio.push_back(right_ch[i]);
+        }
+    };
+    generate_audio_batch(models, jobs);
+    return outputs;
+}
+
+// p50 latency of each stage over the warm-up and measured generations of the options
+static std::map<std::string, double> measure_golden_latency(AudioGenModels& models, const AudioGenJob& golden_job, const BenchOptions& options) {
+    const std::vector<AudioGenJob> jobs = {golden_job};
+    for (size_t i = 0; i < options.warmup; ++i) {
+        generate_audio_batch(models, jobs);
+    }
+    std::vector<AudioGenTimings> runs;
+    for (size_t i = 0; i < options.iterations; ++i) {
+        runs.push_back(generate_audio_batch(models, jobs));
+    }
+
+    std::map<std::string, double> p50_ms;
+    for (const char* stage : k_golden_stages) {
+        p50_ms[stage] = make_row("", "", "", 0, 0, "", "", stage, get_stage_values(runs, stage)).p50;
+    }
+    return p50_ms;
+}
+
+static int32_t run_golden_record(const BenchOptions& options) {
+    const std::string& dir = options.golden_record_dir;
+    std::filesystem::create_directories(dir);
+
+    GoldenConfig golden;
+    golden.prompt = options.prompt;
+    golden.seed = options.seed;
+    golden.steps = options.steps[0];
+    golden.sampler = options.samplers[0];
+    golden.precisions = options.precisions[0];
+    golden.threads = options.threads[0];
+
+    auto models = load_golden_models(options.models_base_path, golden);
+    const AudioGenJob golden_job = make_golden_job(golden, options.output_path);
+
+    const GoldenOutputs outputs = capture_golden_outputs(*models, golden_job);
+    write_floats(get_golden_path(dir, "t5_crossattn.f32"), outputs.crossattn);
+    write_floats(get_golden_path(dir, "t5_globalcond.f32"), outputs.globalcond);
+    for (size_t i = 0; i < outputs.dit_steps.size(); ++i) {
+        write_floats(get_golden_path(dir, get_dit_step_name(i)), outputs.dit_steps[i]);
+    }
+    write_floats(get_golden_path(dir, "audio.f32"), outputs.audio);
+
+    golden.p50_ms = measure_golden_latency(*models, golden_job, options);
+    write_golden_config(get_golden_path(dir, "golden.txt"), golden);
+
+    printf("Recorded %zu DiT steps and %zu audio samples of \"%s\", seed %zu, %s, %s, %zu threads to %s\n", outputs.dit_steps.size(),
+           outputs.audio.size(), golden.prompt.c_str(), golden.seed, get_sampler_name(golden.sampler), get_precisions_name(golden.precisions).c_str(),
+           golden.threads, dir.c_str());
+    for (const auto& p50 : golden.p50_ms) {
+        printf("Baseline %-12s p50 %10.1f ms\n", p50.first.c_str(), p50.second);
+    }
+    return 0;
+}
+
+static int32_t run_golden_check(const BenchOptions& options) {
+    const std::string& dir = options.golden_check_dir;
+    const GoldenConfig golden = read_golden_config(get_golden_path(dir, "golden.txt"));
+
+    auto models = load_golden_models(options.models_base_path, golden);
+    const AudioGenJob golden_job = make_golden_job(golden, options.output_path);
+
+    printf("Golden check of \"%s\", seed %zu, %zu steps, %s, %s, %zu threads against %s\n", golden.prompt.c_str(), golden.seed, golden.steps,
+           get_sampler_name(golden.sampler), get_precisions_name(golden.precisions).c_str(), golden.threads, dir.c_str());
+
+    size_t num_failures = 0;
+
+    // ----- Outputs of the stage boundaries
+    const GoldenOutputs outputs = capture_golden_outputs(*models, golden_job);
+    const auto check_output = [&](const std::string& name, const std::vector<float>& values) {
+        const std::vector<float> ref = read_floats(get_golden_path(dir, name));
+        if (ref.size() != values.size()) {
+            printf("%-22s FAIL: %zu values, %zu in the reference\n", name.c_str(), values.size(), ref.size());
+            ++num_failures;
+            return;
+        }
+        const double snr_db = get_snr_db(ref, values);
+        const bool ok = snr_db >= options.min_snr_db;
+        printf("%-22s SNR %10.1f dB  %s\n", name.c_str(), snr_db, ok ? "ok" : "FAIL");
+        num_failures += ok ? 0 : 1;
+    };
+    check_output("t5_crossattn.f32", outputs.crossattn);
+    check_output("t5_globalcond.f32", outputs.globalcond);
+    for (size_t i = 0; i < outputs.dit_steps.size(); ++i) {
+        check_output(get_dit_step_name(i), outputs.dit_steps[i]);
+    }
+    check_output("audio.f32", outputs.audio);
+
+    // ----- Latency of the stages
+    const std::map<std::string, double> p50_ms = measure_golden_latency(*models, golden_job, options);
+    for (const auto& p50 : p50_ms) {
+        const auto baseline = golden.p50_ms.find(p50.first);
+        if (baseline == golden.p50_ms.end()) {
+            continue;
+        }
+        const double limit = baseline->second * (1.0 + options.max_regression_pct / 100.0) + k_golden_latency_slack_ms;
+        const double change_pct = baseline->second > 0.0 ? 100.0 * (p50.second / baseline->second - 1.0) : 0.0;
+        const bool ok = p50.second <= limit;
+        printf("%-22s p50 %10.1f ms, baseline %10.1f ms (%+.1f%%)  %s\n", p50.first.c_str(), p50.second, baseline->second, change_pct, ok ? "ok" : "FAIL");
+        num_failures += ok ? 0 : 1;
+    }
+
+    printf("Golden check %s: %zu failures (min SNR %.1f dB, max regression %.1f%%)\n", num_failures == 0 ? "passed" : "failed", num_failures,
+           options.min_snr_db, options.max_regression_pct);
+    return num_failures == 0 ? 0 : 1;
+}
+
+int main(int32_t argc, char** argv) {
+    BenchOptions options;
+    if (!parse_options(argc, argv, options)) {
+        print_usage();
+        return 1;
+    }
+
+    try {
+        if (!options.golden_record_dir.empty()) {
+            return run_golden_record(options);
+        }
+        if (!options.golden_check_dir.empty()) {
+            return run_golden_check(options);
+        }
+        return run_bench(options);
+    } catch (const AudioGenError& e) {
+        printf("ERROR: %s\n", e.what());
+        return 1;
+    }
+}
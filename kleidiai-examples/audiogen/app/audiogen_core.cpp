@@ -0,0 +1,2201 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Arm Limited and/or its
+ * affiliates <open-source-office@arm.com>
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "audiogen_core.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cinttypes>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <exception>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+
+#include <sentencepiece_processor.h>
+
+#include "sampler.h"
+
+AudioGenTokenizer::AudioGenTokenizer() = default;
+
+AudioGenTokenizer::~AudioGenTokenizer() = default;
+
+void AudioGenTokenizer::load(const std::string& spiece_model_path, size_t seq_len) {
+    AUDIOGEN_CHECK(seq_len > 0);
+    processor_ = std::make_unique<sentencepiece::SentencePieceProcessor>();
+    AUDIOGEN_CHECK(processor_->Load(spiece_model_path).ok());
+    seq_len_ = seq_len;
+}
+
+void AudioGenTokenizer::encode_batch(const std::vector<const std::string*>& prompts, std::vector<std::vector<int32_t>>& ids) const {
+    AUDIOGEN_CHECK(processor_ != nullptr);
+
+    ids.resize(prompts.size());
+    for (size_t i = 0; i < prompts.size(); ++i) {
+        std::vector<int32_t>& prompt_ids = ids[i];
+        prompt_ids.clear();
+        AUDIOGEN_CHECK(processor_->Encode(*prompts[i], &prompt_ids).ok());
+
+        // Make sure we have the end-of-sequence token at the end, also when the prompt is truncated
+        if (prompt_ids.empty() || prompt_ids.back() != k_t5_eos_id) {
+            prompt_ids.push_back(k_t5_eos_id);
+        }
+        if (prompt_ids.size() > seq_len_) {
+            prompt_ids.resize(seq_len_);
+            prompt_ids.back() = k_t5_eos_id;
+        }
+    }
+}
+
+void AudioGenTokenizer::write_t5_inputs(const std::vector<int32_t>& ids, int64_t* ids_out, int64_t* attnmask_out) const {
+    const size_t num_ids = std::min(ids.size(), seq_len_);
+    for (size_t i = 0; i < num_ids; ++i) {
+        ids_out[i] = ids[i];
+        attnmask_out[i] = 1;
+    }
+    std::fill(ids_out + num_ids, ids_out + seq_len_, int64_t(0));
+    std::fill(attnmask_out + num_ids, attnmask_out + seq_len_, int64_t(0));
+}
+
+void write_wav_header(std::ostream& out_file, size_t buffer_sz, AudioGenSampleFormat format) {
+    constexpr int32_t audio_sr = k_audio_sample_rate;
+    constexpr int32_t audio_num_channels = 2;
+    const int32_t audio_bits_per_sample = 8 * get_bytes_per_sample(format);
+    const uint16_t audio_format = format == AudioGenSampleFormat::f32 ? 3 : 1; // IEEE float or PCM
+
+    const int32_t byte_rate = audio_sr * audio_num_channels * (audio_bits_per_sample / 8);
+    const int32_t block_align = audio_num_channels * (audio_bits_per_sample / 8);
+    const int32_t data_chunk_sz = buffer_sz * get_bytes_per_frame(format);
+    const int32_t fmt_chunk_sz = 16;
+    const int32_t header_sz = 44;
+    const int32_t file_sz = header_sz + data_chunk_sz - 8;
+
+    // Prepare the header
+    // RIFF header
+    out_file.write("RIFF", 4);
+    out_file.write(reinterpret_cast<const char*>(&file_sz), 4);
+    out_file.write("WAVE", 4);
+    out_file.write("fmt ", 4);
+    out_file.write(reinterpret_cast<const char*>(&fmt_chunk_sz), 4);
+    out_file.write(reinterpret_cast<const char*>(&audio_format), 2);
+    out_file.write(reinterpret_cast<const char*>(&audio_num_channels), 2);
+    out_file.write(reinterpret_cast<const char*>(&audio_sr), 4);
+    out_file.write(reinterpret_cast<const char*>(&byte_rate), 4);
+    out_file.write(reinterpret_cast<const char*>(&block_align), 2);
+    out_file.write(reinterpret_cast<const char*>(&audio_bits_per_sample), 2);
+
+    out_file.write("data", 4);
+    out_file.write(reinterpret_cast<const char*>(&data_chunk_sz), 4);
+}
+
+// WAV output of a job, to its output path or to the standard output when the path is "-". Each
+// write converts the frames to the output format in a single block, which is written at once
+class AudioGenWavWriter {
+public:
+    AudioGenWavWriter(const std::string& path, size_t buffer_sz, AudioGenSampleFormat format)
+        : format_(format), is_stdout_(path == "-") {
+        file_ = is_stdout_ ? stdout : fopen(path.c_str(), "wb");
+        AUDIOGEN_CHECK(file_ != nullptr);
+
+        std::ostringstream header;
+        write_wav_header(header, buffer_sz, format);
+        const std::string header_bytes = header.str();
+        AUDIOGEN_CHECK(fwrite(header_bytes.data(), 1, header_bytes.size(), file_) == header_bytes.size());
+    }
+
+    ~AudioGenWavWriter() {
+        if (is_stdout_) {
+            fflush(file_);
+        } else {
+            fclose(file_);
+        }
+    }
+
+    AudioGenWavWriter(const AudioGenWavWriter&) = delete;
+    AudioGenWavWriter& operator=(const AudioGenWavWriter&) = delete;
+
+    void write(const float* left_ch, const float* right_ch, size_t buffer_sz) {
+        block_.resize(buffer_sz * get_bytes_per_frame(format_));
+        convert_frames(left_ch, right_ch, buffer_sz, format_, dither_, block_.data());
+        AUDIOGEN_CHECK(fwrite(block_.data(), 1, block_.size(), file_) == block_.size());
+    }
+
+    void flush() {
+        fflush(file_);
+    }
+
+private:
+    const AudioGenSampleFormat format_;
+    const bool is_stdout_;
+    FILE* file_ = nullptr;
+    AudioGenDither dither_;
+    std::vector<uint8_t> block_;
+};
+
+// Hand the whole audio of a job to its writer, or save it to its output path
+static void write_job_audio(const AudioGenJob& job, const float* left_ch, const float* right_ch, size_t buffer_sz) {
+    if (job.write_audio) {
+        job.write_audio(left_ch, right_ch, buffer_sz);
+        return;
+    }
+    AudioGenWavWriter writer(job.output_path, buffer_sz, job.output_format);
+    writer.write(left_ch, right_ch, buffer_sz);
+}
+
+static size_t get_num_elems(const TfLiteIntArray* dims) {
+    size_t x = 1;
+    for (size_t i = 0; i < dims->size; ++i) {
+        x *= dims->data[i];
+    }
+    return x;
+}
+
+// 64-bit FNV-1a hash of sz bytes, continuing from hash
+constexpr uint64_t k_fnv_offset = 14695981039346656037ull;
+constexpr uint64_t k_fnv_prime = 1099511628211ull;
+
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t sz) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < sz; ++i) {
+        hash = (hash ^ bytes[i]) * k_fnv_prime;
+    }
+    return hash;
+}
+
+void AudioGenCondCache::configure(size_t max_entries, const std::string& disk_dir, size_t crossattn_sz, size_t globalcond_sz) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_entries_ = max_entries;
+    disk_dir_ = disk_dir;
+    crossattn_sz_ = crossattn_sz;
+    globalcond_sz_ = globalcond_sz;
+    if (!disk_dir_.empty()) {
+        std::filesystem::create_directories(disk_dir_);
+    }
+}
+
+bool AudioGenCondCache::find_prompt(const std::string& prompt, float audio_len_sec, float* crossattn, float* globalcond) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = prompts_.find(make_prompt_key(prompt, audio_len_sec));
+    if (it == prompts_.end()) {
+        return false;
+    }
+    use_entry(it->second, crossattn, globalcond);
+    ++stats_.hits;
+    return true;
+}
+
+bool AudioGenCondCache::find_ids(const std::string& prompt, const std::vector<int32_t>& ids, float audio_len_sec, float* crossattn, float* globalcond) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const std::string key = make_key(ids, audio_len_sec);
+
+    auto it = entries_.find(key);
+    if (it != entries_.end()) {
+        use_entry(it->second, crossattn, globalcond);
+        add_prompt(it->second, make_prompt_key(prompt, audio_len_sec));
+        ++stats_.hits;
+        return true;
+    }
+
+    Entry entry;
+    if (!load_entry(key, entry)) {
+        ++stats_.misses;
+        return false;
+    }
+    auto entry_it = add_entry(std::move(entry));
+    use_entry(entry_it, crossattn, globalcond);
+    add_prompt(entry_it, make_prompt_key(prompt, audio_len_sec));
+    ++stats_.disk_hits;
+    return true;
+}
+
+void AudioGenCondCache::insert(const std::string& prompt, const std::vector<int32_t>& ids, float audio_len_sec, const float* crossattn, const float* globalcond) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry entry;
+    entry.key = make_key(ids, audio_len_sec);
+    if (entries_.count(entry.key) > 0) {
+        return;
+    }
+    entry.crossattn.assign(crossattn, crossattn + crossattn_sz_);
+    entry.globalcond.assign(globalcond, globalcond + globalcond_sz_);
+    store_entry(entry);
+
+    auto entry_it = add_entry(std::move(entry));
+    add_prompt(entry_it, make_prompt_key(prompt, audio_len_sec));
+}
+
+AudioGenCondCacheStats AudioGenCondCache::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    AudioGenCondCacheStats stats = stats_;
+    stats.entries = lru_.size();
+    return stats;
+}
+
+std::string AudioGenCondCache::make_key(const std::vector<int32_t>& ids, float audio_len_sec) {
+    std::string key(sizeof(float) + ids.size() * sizeof(int32_t), '\0');
+    memcpy(&key[0], &audio_len_sec, sizeof(float));
+    memcpy(&key[sizeof(float)], ids.data(), ids.size() * sizeof(int32_t));
+    return key;
+}
+
+std::string AudioGenCondCache::make_prompt_key(const std::string& prompt, float audio_len_sec) {
+    std::string key(sizeof(float), '\0');
+    memcpy(&key[0], &audio_len_sec, sizeof(float));
+    return key + prompt;
+}
+
+size_t AudioGenCondCache::entry_bytes(const Entry& entry) {
+    size_t bytes = entry.key.size() + (entry.crossattn.size() + entry.globalcond.size()) * sizeof(float);
+    for (const std::string& prompt_key : entry.prompt_keys) {
+        bytes += prompt_key.size();
+    }
+    return bytes;
+}
+
+void AudioGenCondCache::use_entry(EntryIt it, float* crossattn, float* globalcond) {
+    lru_.splice(lru_.begin(), lru_, it);
+    memcpy(crossattn, it->crossattn.data(), crossattn_sz_ * sizeof(float));
+    memcpy(globalcond, it->globalcond.data(), globalcond_sz_ * sizeof(float));
+}
+
+void AudioGenCondCache::add_prompt(EntryIt it, const std::string& prompt_key) {
+    if (prompts_.emplace(prompt_key, it).second) {
+        it->prompt_keys.push_back(prompt_key);
+        stats_.bytes += prompt_key.size();
+    }
+}
+
+AudioGenCondCache::EntryIt AudioGenCondCache::add_entry(Entry&& entry) {
+    stats_.bytes += entry_bytes(entry);
+    lru_.push_front(std::move(entry));
+    entries_.emplace(lru_.front().key, lru_.begin());
+
+    while (lru_.size() > max_entries_) {
+        const Entry& last = lru_.back();
+        for (const std::string& prompt_key : last.prompt_keys) {
+            prompts_.erase(prompt_key);
+        }
+        entries_.erase(last.key);
+        stats_.bytes -= entry_bytes(last);
+        lru_.pop_back();
+    }
+    return lru_.begin();
+}
+
+std::string AudioGenCondCache::disk_path(const std::string& key) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.t5cond", static_cast<unsigned long long>(fnv1a(k_fnv_offset, key.data(), key.size())));
+    return (std::filesystem::path(disk_dir_) / name).string();
+}
+
+bool AudioGenCondCache::load_entry(const std::string& key, Entry& entry) const {
+    if (disk_dir_.empty()) {
+        return false;
+    }
+    std::ifstream in_file(disk_path(key), std::ios::binary);
+    uint64_t key_sz = 0;
+    uint64_t crossattn_sz = 0;
+    uint64_t globalcond_sz = 0;
+    if (!in_file.read(reinterpret_cast<char*>(&key_sz), sizeof(key_sz)) || key_sz != key.size()) {
+        return false;
+    }
+    entry.key.resize(key_sz);
+    in_file.read(&entry.key[0], key_sz);
+    in_file.read(reinterpret_cast<char*>(&crossattn_sz), sizeof(crossattn_sz));
+    in_file.read(reinterpret_cast<char*>(&globalcond_sz), sizeof(globalcond_sz));
+    if (!in_file || entry.key != key || crossattn_sz != crossattn_sz_ || globalcond_sz != globalcond_sz_) {
+        return false;
+    }
+    entry.crossattn.resize(crossattn_sz);
+    entry.globalcond.resize(globalcond_sz);
+    in_file.read(reinterpret_cast<char*>(entry.crossattn.data()), crossattn_sz * sizeof(float));
+    in_file.read(reinterpret_cast<char*>(entry.globalcond.data()), globalcond_sz * sizeof(float));
+    return static_cast<bool>(in_file);
+}
+
+void AudioGenCondCache::store_entry(const Entry& entry) const {
+    if (disk_dir_.empty()) {
+        return;
+    }
+    const std::string path = disk_path(entry.key);
+    const std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream out_file(tmp_path, std::ios::binary);
+        const uint64_t key_sz = entry.key.size();
+        const uint64_t crossattn_sz = entry.crossattn.size();
+        const uint64_t globalcond_sz = entry.globalcond.size();
+        out_file.write(reinterpret_cast<const char*>(&key_sz), sizeof(key_sz));
+        out_file.write(entry.key.data(), key_sz);
+        out_file.write(reinterpret_cast<const char*>(&crossattn_sz), sizeof(crossattn_sz));
+        out_file.write(reinterpret_cast<const char*>(&globalcond_sz), sizeof(globalcond_sz));
+        out_file.write(reinterpret_cast<const char*>(entry.crossattn.data()), crossattn_sz * sizeof(float));
+        out_file.write(reinterpret_cast<const char*>(entry.globalcond.data()), globalcond_sz * sizeof(float));
+        if (!out_file) {
+            fprintf(stderr, "Cannot write the conditioning cache file %s\n", tmp_path.c_str());
+            return;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, path, ec);
+}
+
+// Identify a model file without reading it entirely, from its size, its modification
+// time and the content of its first and last 64 KiB
+static uint64_t fingerprint_model(const std::string& model_path) {
+    constexpr size_t k_sample_sz = 64 * 1024;
+
+    uint64_t hash = k_fnv_offset;
+    auto hash_bytes = [&hash](const void* data, size_t sz) {
+        hash = fnv1a(hash, data, sz);
+    };
+
+    const uint64_t file_sz = std::filesystem::file_size(model_path);
+    const int64_t mtime = std::filesystem::last_write_time(model_path).time_since_epoch().count();
+    hash_bytes(&file_sz, sizeof(file_sz));
+    hash_bytes(&mtime, sizeof(mtime));
+
+    std::vector<char> sample(std::min<uint64_t>(k_sample_sz, file_sz));
+    std::ifstream in_file(model_path, std::ios::binary);
+    in_file.read(sample.data(), sample.size());
+    hash_bytes(sample.data(), sample.size());
+    in_file.seekg(file_sz - sample.size());
+    in_file.read(sample.data(), sample.size());
+    hash_bytes(sample.data(), sample.size());
+
+    return hash;
+}
+
+// Return the path of the packed-weight cache file of a model, named
+// <model>.<delegate flags>.<fingerprint>.xnnpack_cache. The cache files of the same model and
+// flags with a different fingerprint are stale and get removed, while the files of other flags
+// are kept for the stages or runs that use them
+static std::string get_weight_cache_path(const std::string& cache_dir, const std::string& model_path, uint32_t delegate_flags) {
+    namespace fs = std::filesystem;
+    constexpr const char* k_cache_ext = ".xnnpack_cache";
+
+    char flags[9];
+    snprintf(flags, sizeof(flags), "%08x", static_cast<unsigned>(delegate_flags));
+    char fingerprint[17];
+    snprintf(fingerprint, sizeof(fingerprint), "%016llx", static_cast<unsigned long long>(fingerprint_model(model_path)));
+
+    const std::string cache_prefix = fs::path(model_path).stem().string() + "." + flags + ".";
+    const std::string cache_name = cache_prefix + fingerprint + k_cache_ext;
+
+    fs::create_directories(cache_dir);
+    for (const fs::directory_entry& entry : fs::directory_iterator(cache_dir)) {
+        const std::string name = entry.path().filename().string();
+        if (name == cache_name || name.size() != cache_name.size() || name.compare(0, cache_prefix.size(), cache_prefix) != 0 ||
+            entry.path().extension() != k_cache_ext) {
+            continue;
+        }
+        fprintf(stderr, "Removing stale weight cache %s\n", entry.path().c_str());
+        fs::remove(entry.path());
+    }
+
+    return (fs::path(cache_dir) / cache_name).string();
+}
+
+const char* get_precision_name(AudioGenPrecision precision) {
+    switch (precision) {
+        case AudioGenPrecision::fp16: return "fp16";
+        case AudioGenPrecision::int8: return "int8";
+        default: return "fp32";
+    }
+}
+
+bool parse_precision(const std::string& name, AudioGenPrecision& precision) {
+    for (AudioGenPrecision p : {AudioGenPrecision::fp32, AudioGenPrecision::fp16, AudioGenPrecision::int8}) {
+        if (name == get_precision_name(p)) {
+            precision = p;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* get_huge_pages_name(AudioGenHugePages huge_pages) {
+    switch (huge_pages) {
+        case AudioGenHugePages::thp: return "thp";
+        case AudioGenHugePages::hugetlb: return "hugetlb";
+        default: return "none";
+    }
+}
+
+bool parse_huge_pages(const std::string& name, AudioGenHugePages& huge_pages) {
+    for (AudioGenHugePages h : {AudioGenHugePages::none, AudioGenHugePages::thp, AudioGenHugePages::hugetlb}) {
+        if (name == get_huge_pages_name(h)) {
+            huge_pages = h;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Model of a stage for a precision: <stem>_<precision>.tflite when it exists, default_name otherwise
+static std::string get_stage_model_path(const std::string& models_base_path, const char* stem, const char* default_name, AudioGenPrecision precision) {
+    const std::string variant_path = models_base_path + "/" + stem + "_" + get_precision_name(precision) + ".tflite";
+    if (std::filesystem::exists(variant_path)) {
+        return variant_path;
+    }
+    return models_base_path + "/" + default_name;
+}
+
+// Constant int8 tensors are the weights of a dynamic-range quantized model
+static bool has_int8_weights(tflite::Interpreter* interpreter) {
+    for (size_t i = 0; i < interpreter->tensors_size(); ++i) {
+        const TfLiteTensor* tensor = interpreter->tensor(i);
+        if (tensor->type == kTfLiteInt8 && tensor->allocation_type == kTfLiteMmapRo) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// ----- CPU affinity
+// Upper bound of the CPU numbers, which matches CPU_SETSIZE on Linux
+constexpr long k_max_cpus = 1024;
+
+bool parse_cpu_list(const std::string& s, std::vector<int32_t>& cpus) {
+    cpus.clear();
+    size_t pos = 0;
+    while (pos < s.size()) {
+        size_t end = s.find(',', pos);
+        if (end == std::string::npos) {
+            end = s.size();
+        }
+        const std::string item = s.substr(pos, end - pos);
+        const size_t dash = item.find('-');
+        char* first_end = nullptr;
+        char* last_end = nullptr;
+        const long first = strtol(item.c_str(), &first_end, 10);
+        const long last = dash == std::string::npos ? first : strtol(item.c_str() + dash + 1, &last_end, 10);
+        if (item.empty() || first_end == item.c_str() || (dash != std::string::npos && last_end == item.c_str() + dash + 1) ||
+            first < 0 || last < first || last >= k_max_cpus) {
+            return false;
+        }
+        for (long cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(static_cast<int32_t>(cpu));
+        }
+        pos = end + 1;
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return !cpus.empty();
+}
+
+std::string format_cpu_list(const std::vector<int32_t>& cpus) {
+    std::string s;
+    for (size_t i = 0; i < cpus.size();) {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+            ++j;
+        }
+        s += (s.empty() ? "" : ",") + std::to_string(cpus[i]);
+        if (j > i) {
+            s += "-" + std::to_string(cpus[j]);
+        }
+        i = j + 1;
+    }
+    return s.empty() ? "all" : s;
+}
+
+std::vector<AudioGenCpuCluster> get_cpu_clusters() {
+    std::vector<int32_t> cpus;
+    std::ifstream online_file("/sys/devices/system/cpu/online");
+    std::string online;
+    if (!std::getline(online_file, online) || !parse_cpu_list(online, cpus)) {
+        cpus.clear();
+        for (int32_t cpu = 0; cpu < static_cast<int32_t>(std::max(1u, std::thread::hardware_concurrency())); ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+
+    // The CPUs without a capacity nor a maximum frequency all get the capacity 0
+    std::map<size_t, std::vector<int32_t>> capacity_cpus;
+    for (int32_t cpu : cpus) {
+        const std::string cpu_dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+        size_t capacity = 0;
+        std::ifstream capacity_file(cpu_dir + "/cpu_capacity");
+        if (!(capacity_file >> capacity)) {
+            capacity = 0;
+            std::ifstream max_freq_file(cpu_dir + "/cpufreq/cpuinfo_max_freq");
+            if (!(max_freq_file >> capacity)) {
+                capacity = 0;
+            }
+        }
+        capacity_cpus[capacity].push_back(cpu);
+    }
+
+    std::vector<AudioGenCpuCluster> clusters;
+    for (const auto& it : capacity_cpus) {
+        clusters.push_back({it.first, it.second});
+    }
+    return clusters;
+}
+
+bool get_policy_affinity(const std::string& policy, const std::vector<AudioGenCpuCluster>& clusters, AudioGenAffinity& affinity) {
+    std::vector<int32_t> cpus;
+    if (policy == "none") {
+        // Keep cpus empty
+    } else if (policy == "little") {
+        cpus = clusters.front().cpus;
+    } else if (policy == "big") {
+        for (size_t i = clusters.size() > 1 ? 1 : 0; i < clusters.size(); ++i) {
+            cpus.insert(cpus.end(), clusters[i].cpus.begin(), clusters[i].cpus.end());
+        }
+        std::sort(cpus.begin(), cpus.end());
+    } else if (policy == "prime") {
+        cpus = clusters.back().cpus;
+    } else {
+        return false;
+    }
+    affinity.t5 = cpus;
+    affinity.dit = cpus;
+    affinity.autoencoder = cpus;
+    return true;
+}
+
+void print_affinity(FILE* out, const std::vector<AudioGenCpuCluster>& clusters, const AudioGenAffinity& affinity) {
+    fprintf(out, "CPU clusters:");
+    for (const AudioGenCpuCluster& cluster : clusters) {
+        fprintf(out, " [%s] capacity %zu", format_cpu_list(cluster.cpus).c_str(), cluster.capacity);
+    }
+    fprintf(out, "\nAffinity: T5 %s, DiT %s, Autoencoder %s\n", format_cpu_list(affinity.t5).c_str(),
+            format_cpu_list(affinity.dit).c_str(), format_cpu_list(affinity.autoencoder).c_str());
+}
+
+// Pin the calling thread to cpus, if any. The threads it creates afterwards inherit its affinity.
+// The affinity is only supported on Linux and Android
+static void set_thread_affinity(const std::vector<int32_t>& cpus) {
+#if defined(__linux__)
+    if (cpus.empty()) {
+        return;
+    }
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (int32_t cpu : cpus) {
+        CPU_SET(cpu, &cpu_set);
+    }
+    if (sched_setaffinity(0, sizeof(cpu_set), &cpu_set) != 0) {
+        fprintf(stderr, "WARNING: cannot pin the thread to the CPUs %s\n", format_cpu_list(cpus).c_str());
+    }
+#else
+    (void)cpus;
+#endif
+}
+
+static std::vector<int32_t> get_thread_affinity() {
+    std::vector<int32_t> cpus;
+#if defined(__linux__)
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0) {
+        for (int32_t cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &cpu_set)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+#endif
+    return cpus;
+}
+
+// Ask the kernel to read a whole file ahead in the page cache, without waiting for it
+static void prefetch_file(const std::string& path) {
+#if defined(__linux__)
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+#else
+    (void)path;
+#endif
+}
+
+// Hint the kernel about the next accesses to a memory-mapped model
+static void advise_model(const tflite::FlatBufferModel& model, int advice) {
+    const tflite::Allocation* allocation = model.allocation();
+    if (allocation != nullptr && allocation->type() == tflite::Allocation::Type::kMMap) {
+        madvise(const_cast<void*>(allocation->base()), allocation->bytes(), advice);
+    }
+}
+
+// ----- Huge pages and NUMA placement
+// ----------------------------------
+// The NUMA policies are set with the raw system calls, since <numaif.h> is only installed with libnuma
+constexpr int k_mpol_default = 0;
+constexpr int k_mpol_preferred = 1;
+constexpr int k_mpol_bind = 2;
+constexpr unsigned k_mpol_mf_move = 1 << 1;
+
+// Synchronous collapse of a range into transparent huge pages, since Linux 6.1
+#if defined(__linux__) && !defined(MADV_COLLAPSE)
+#define MADV_COLLAPSE 25
+#endif
+
+void MappedMemoryDeleter::operator()(void* ptr) const {
+    munmap(ptr, bytes);
+}
+
+// Value, in kB, of a field of a file like /proc/self/status, or 0 when it cannot be read
+static size_t read_proc_kb(const char* path, const char* field) {
+    const size_t field_len = strlen(field);
+    std::ifstream proc_file(path);
+    std::string line;
+    while (std::getline(proc_file, line)) {
+        if (line.compare(0, field_len, field) == 0) {
+            return std::strtoull(line.c_str() + field_len, nullptr, 10);
+        }
+    }
+    return 0;
+}
+
+// Size of a transparent huge page, 2 MB with 4 KB pages and 512 MB with 64 KB pages
+static size_t get_thp_size() {
+    std::ifstream size_file("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size");
+    size_t size = 0;
+    return (size_file >> size) && size > 0 ? size : 2 * 1024 * 1024;
+}
+
+static size_t align_up(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// NUMA node holding all the cpus, or -1 when they span several nodes or are not known
+static int32_t get_numa_node(const std::vector<int32_t>& cpus) {
+    namespace fs = std::filesystem;
+
+    if (cpus.empty()) {
+        return -1;
+    }
+    std::error_code error;
+    for (const fs::directory_entry& entry : fs::directory_iterator("/sys/devices/system/node", error)) {
+        const std::string name = entry.path().filename().string();
+        if (name.compare(0, 4, "node") != 0 || name.size() == 4 || !isdigit(static_cast<unsigned char>(name[4]))) {
+            continue;
+        }
+        std::ifstream cpulist_file(entry.path() / "cpulist");
+        std::string cpulist;
+        std::vector<int32_t> node_cpus;
+        if (!std::getline(cpulist_file, cpulist) || !parse_cpu_list(cpulist, node_cpus)) {
+            continue;
+        }
+        const bool has_cpu = std::find(node_cpus.begin(), node_cpus.end(), cpus.front()) != node_cpus.end();
+        if (has_cpu) {
+            for (int32_t cpu : cpus) {
+                if (std::find(node_cpus.begin(), node_cpus.end(), cpu) == node_cpus.end()) {
+                    return -1;
+                }
+            }
+            // The node masks of the system calls hold a single unsigned long
+            const int32_t node = std::atoi(name.c_str() + 4);
+            return node < static_cast<int32_t>(8 * sizeof(unsigned long)) ? node : -1;
+        }
+    }
+    return -1;
+}
+
+// Prefer the NUMA node of a stage for the pages allocated by the calling thread, until the end of the scope
+class ScopedNumaNode {
+public:
+    explicit ScopedNumaNode(int32_t node) : active_(node >= 0) {
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+        if (active_) {
+            const unsigned long node_mask = 1UL << node;
+            if (syscall(SYS_set_mempolicy, k_mpol_preferred, &node_mask, sizeof(node_mask) * 8) != 0) {
+                fprintf(stderr, "WARNING: cannot prefer the NUMA node %d\n", node);
+                active_ = false;
+            }
+        }
+#endif
+    }
+
+    ~ScopedNumaNode() {
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+        if (active_) {
+            syscall(SYS_set_mempolicy, k_mpol_default, nullptr, 0);
+        }
+#endif
+    }
+
+    ScopedNumaNode(const ScopedNumaNode&) = delete;
+    ScopedNumaNode& operator=(const ScopedNumaNode&) = delete;
+
+private:
+    bool active_;
+};
+
+// Bind a range to a NUMA node before it is touched
+static void bind_numa_node(void* data, size_t bytes, int32_t node) {
+#if defined(__linux__) && defined(SYS_mbind)
+    if (node >= 0) {
+        const unsigned long node_mask = 1UL << node;
+        if (syscall(SYS_mbind, data, bytes, k_mpol_bind, &node_mask, sizeof(node_mask) * 8, k_mpol_mf_move) != 0) {
+            fprintf(stderr, "WARNING: cannot bind the model to the NUMA node %d\n", node);
+        }
+    }
+#else
+    (void)data;
+    (void)bytes;
+    (void)node;
+#endif
+}
+
+// Anonymous memory of bytes bytes in explicit huge pages, or aligned to the transparent huge pages
+// and advised to use them. huge_pages is set to the pages actually used
+static MappedMemory map_huge_pages(size_t bytes, AudioGenHugePages& huge_pages) {
+#if defined(__linux__)
+    if (huge_pages == AudioGenHugePages::hugetlb) {
+        const size_t hugetlb_sz = read_proc_kb("/proc/meminfo", "Hugepagesize:") * 1024;
+        if (hugetlb_sz > 0) {
+            const size_t mapped_bytes = align_up(bytes, hugetlb_sz);
+            void* data = mmap(nullptr, mapped_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (data != MAP_FAILED) {
+                return MappedMemory(data, MappedMemoryDeleter{mapped_bytes});
+            }
+        }
+        fprintf(stderr, "WARNING: not enough huge pages reserved in /proc/sys/vm/nr_hugepages, using transparent huge pages\n");
+        huge_pages = AudioGenHugePages::thp;
+    }
+
+    // Map one more huge page to align the start of the memory on a huge page
+    const size_t thp_sz = get_thp_size();
+    const size_t mapped_bytes = align_up(bytes, thp_sz);
+    void* base = mmap(nullptr, mapped_bytes + thp_sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    AUDIOGEN_CHECK(base != MAP_FAILED);
+    const uintptr_t start = align_up(reinterpret_cast<uintptr_t>(base), thp_sz);
+    const size_t head = start - reinterpret_cast<uintptr_t>(base);
+    if (head > 0) {
+        munmap(base, head);
+    }
+    if (thp_sz > head) {
+        munmap(reinterpret_cast<void*>(start + mapped_bytes), thp_sz - head);
+    }
+    void* data = reinterpret_cast<void*>(start);
+    madvise(data, mapped_bytes, MADV_HUGEPAGE);
+    return MappedMemory(data, MappedMemoryDeleter{mapped_bytes});
+#else
+    (void)bytes;
+    huge_pages = AudioGenHugePages::none;
+    return MappedMemory();
+#endif
+}
+
+// Read a model file to huge pages on the NUMA node of its stage
+static MappedMemory read_model_to_huge_pages(const std::string& model_path, const AudioGenStageParams& params, size_t& bytes,
+                                             AudioGenStageStartup& startup) {
+    std::ifstream model_file(model_path, std::ios::binary | std::ios::ate);
+    AUDIOGEN_CHECK(model_file.is_open());
+    bytes = static_cast<size_t>(model_file.tellg());
+    model_file.seekg(0);
+
+    startup.huge_pages = params.huge_pages;
+    MappedMemory memory = map_huge_pages(bytes, startup.huge_pages);
+    AUDIOGEN_CHECK(memory != nullptr);
+    bind_numa_node(memory.get(), bytes, params.numa_node);
+
+    model_file.read(static_cast<char*>(memory.get()), bytes);
+    AUDIOGEN_CHECK(model_file.good());
+    return memory;
+}
+
+// Anonymous mappings of the process, as [start, end) ranges
+static std::vector<std::pair<uintptr_t, uintptr_t>> get_anonymous_mappings() {
+    std::vector<std::pair<uintptr_t, uintptr_t>> mappings;
+    std::ifstream maps_file("/proc/self/maps");
+    std::string line;
+    while (std::getline(maps_file, line)) {
+        unsigned long start = 0;
+        unsigned long end = 0;
+        unsigned long inode = 0;
+        char perms[5] = {};
+        int path_pos = 0;
+        if (sscanf(line.c_str(), "%lx-%lx %4s %*x %*x:%*x %lu %n", &start, &end, perms, &inode, &path_pos) < 4) {
+            continue;
+        }
+        const bool has_path = path_pos > 0 && static_cast<size_t>(path_pos) < line.size();
+        if (inode == 0 && !has_path && perms[0] == 'r' && perms[1] == 'w') {
+            mappings.emplace_back(start, end);
+        }
+    }
+    return mappings;
+}
+
+// Collapse into transparent huge pages the anonymous memory mapped since before, like the buffers
+// of the weights packed by XNNPack. Only the chunks that are mostly resident are collapsed, which
+// leaves out the stacks of the new threads. Return the number of bytes collapsed
+static size_t collapse_new_memory(const std::vector<std::pair<uintptr_t, uintptr_t>>& before) {
+    size_t collapsed_bytes = 0;
+#if defined(__linux__)
+    const size_t thp_sz = get_thp_size();
+    const size_t page_sz = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    std::vector<unsigned char> residency(thp_sz / page_sz);
+
+    const auto is_old = [&before](uintptr_t start, uintptr_t end) {
+        for (const auto& mapping : before) {
+            if (start < mapping.second && mapping.first < end) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    for (const auto& mapping : get_anonymous_mappings()) {
+        for (uintptr_t chunk = align_up(mapping.first, thp_sz); chunk + thp_sz <= mapping.second; chunk += thp_sz) {
+            void* chunk_ptr = reinterpret_cast<void*>(chunk);
+            if (is_old(chunk, chunk + thp_sz) || mincore(chunk_ptr, thp_sz, residency.data()) != 0) {
+                continue;
+            }
+            size_t resident = 0;
+            for (unsigned char r : residency) {
+                resident += r & 1;
+            }
+            if (2 * resident < residency.size()) {
+                continue;
+            }
+            // Without MADV_COLLAPSE, khugepaged collapses the chunk later
+            madvise(chunk_ptr, thp_sz, MADV_HUGEPAGE);
+            if (madvise(chunk_ptr, thp_sz, MADV_COLLAPSE) == 0) {
+                collapsed_bytes += thp_sz;
+            }
+        }
+    }
+#else
+    (void)before;
+#endif
+    return collapsed_bytes;
+}
+
+// Load a model, build its interpreter and apply a dedicated XNNPack delegate to it, or the shared
+// delegate of the shared-arena mode. The threads of the delegate are created with the affinity of the stage
+static void load_stage(AudioGenModels& models, const AudioGenStageParams& params,
+                       MappedMemory& model_memory,
+                       std::unique_ptr<tflite::FlatBufferModel>& model,
+                       std::unique_ptr<TfLiteDelegate, TfLiteDelegateDeleter>& delegate,
+                       std::unique_ptr<tflite::Interpreter>& interpreter,
+                       tflite::Profiler* profiler,
+                       AudioGenStageStartup& startup) {
+
+    // ----- Load the model
+    // ----------------------------------
+    auto start_load = time_in_ms();
+
+    const std::string& model_path = params.model_path;
+    const AudioGenPrecision precision = params.precision;
+    TfLiteXNNPackDelegateOptions xnnpack_options = params.xnnpack_options;
+
+    // The model, the packed weights and the arenas allocated by this thread go to the NUMA node of the stage
+    ScopedNumaNode numa_node(params.numa_node);
+    startup.numa_node = params.numa_node;
+
+    if (params.huge_pages != AudioGenHugePages::none) {
+        size_t model_bytes = 0;
+        model_memory = read_model_to_huge_pages(model_path, params, model_bytes, startup);
+        model = tflite::FlatBufferModel::BuildFromBuffer(static_cast<const char*>(model_memory.get()), model_bytes);
+    } else {
+        model = tflite::FlatBufferModel::BuildFromFile(model_path.c_str());
+    }
+    AUDIOGEN_CHECK(model != nullptr);
+
+    // In the low-memory mode, the model is loaded again before each use, so read it ahead
+    if (models.low_memory) {
+        advise_model(*model, MADV_WILLNEED);
+    }
+
+    // ----- Build the interpreter
+    // ----------------------------------
+    auto start_build = time_in_ms();
+
+    tflite::InterpreterBuilder builder(*model, models.resolver);
+
+    interpreter = std::make_unique<tflite::Interpreter>();
+    builder(&interpreter);
+    AUDIOGEN_CHECK(interpreter != nullptr);
+
+    startup.precision = precision;
+    startup.model_path = model_path;
+    startup.int8_weights = has_int8_weights(interpreter.get());
+    if (precision == AudioGenPrecision::int8 && !startup.int8_weights) {
+        fprintf(stderr, "ERROR: %s has no int8 weights, export the model with a dynamic-range int8 quantization\n", model_path.c_str());
+        AUDIOGEN_CHECK(false && "int8 precision without int8 weights");
+    }
+    if (precision != AudioGenPrecision::int8 && startup.int8_weights) {
+        // The int8 weights would run as a dynamic-range int8 model whatever the precision
+        fprintf(stderr, "ERROR: %s has int8 weights, add a float model of the stage as its _%s.tflite variant\n", model_path.c_str(),
+                get_precision_name(precision));
+        AUDIOGEN_CHECK(false && "float precision with int8 weights");
+    }
+    if (precision == AudioGenPrecision::fp16) {
+        xnnpack_options.flags |= TFLITE_XNNPACK_DELEGATE_FLAG_FORCE_FP16;
+    }
+
+    if (profiler != nullptr) {
+        interpreter->SetProfiler(profiler);
+    }
+
+    // ----- Add the delegate to the interpreter
+    // ----------------------------------
+    auto start_delegate = time_in_ms();
+
+    TfLiteDelegate* stage_delegate = models.xnnpack_delegate_shared.get();
+    if (stage_delegate == nullptr) {
+        const std::string& weight_cache_dir = params.weight_cache_dir;
+        if (!weight_cache_dir.empty()) {
+            // The packed weights are written to the cache file by the first run,
+            // and memory-mapped by the following ones
+            startup.weight_cache_path = get_weight_cache_path(weight_cache_dir, model_path, xnnpack_options.flags);
+            startup.weight_cache_hit = std::filesystem::exists(startup.weight_cache_path);
+            xnnpack_options.weight_cache_file_path = startup.weight_cache_path.c_str();
+        }
+
+        // The delegate creates its thread pool, whose threads inherit the affinity of this thread
+        const std::vector<int32_t> load_cpus = get_thread_affinity();
+        set_thread_affinity(params.cpus);
+        delegate.reset(TfLiteXNNPackDelegateCreate(&xnnpack_options));
+        set_thread_affinity(load_cpus);
+        AUDIOGEN_CHECK(delegate != nullptr);
+        stage_delegate = delegate.get();
+    }
+
+    std::vector<std::pair<uintptr_t, uintptr_t>> mappings_before;
+    if (params.huge_pages != AudioGenHugePages::none) {
+        mappings_before = get_anonymous_mappings();
+    }
+
+    if (interpreter->ModifyGraphWithDelegate(stage_delegate) != kTfLiteOk) {
+        AUDIOGEN_CHECK(false && "Failed to apply XNNPACK delegate");
+    }
+
+    if (params.huge_pages != AudioGenHugePages::none) {
+        startup.collapsed_bytes = collapse_new_memory(mappings_before);
+    }
+
+    // XNNPack has packed the weights of the delegated operators in its own buffers, so their
+    // pages of the model file are no longer needed. The pages still used are read again on access
+    if (models.low_memory) {
+        advise_model(*model, MADV_DONTNEED);
+    }
+
+    // ----- Allocate the tensors
+    // ----------------------------------
+    auto start_allocate = time_in_ms();
+
+    AUDIOGEN_CHECK(interpreter->AllocateTensors() == kTfLiteOk);
+
+    auto end_allocate = time_in_ms();
+
+    startup.start    = (start_load - models.startup.start_time);
+    startup.load     = (start_build - start_load);
+    startup.build    = (start_delegate - start_build);
+    startup.delegate = (start_allocate - start_delegate);
+    startup.allocate = (end_allocate - start_allocate);
+}
+
+// Initial number of events of each profiler. The profilers grow their buffer when it is full
+constexpr uint32_t k_profiler_initial_events = 64 * 1024;
+
+// Alignment required by LiteRT for the custom tensor allocations (kDefaultTensorAlignment)
+constexpr size_t k_tensor_alignment = 64;
+
+static std::string describe_tensor(const char* stage, const char* kind, size_t idx, const TfLiteTensor* tensor) {
+    return std::string(stage) + " " + kind + " " + std::to_string(idx) + " (" + (tensor->name != nullptr ? tensor->name : "") + ")";
+}
+
+// Back the tensor src_id of src and the input tensor dst_id of dst with the same buffer, so that
+// the data produced by one stage is read in place by the next one. Both tensors must have the same
+// size. The interpreters must call AllocateTensors() afterwards
+static bool share_tensor_buffer(AudioGenModels& models, const char* name,
+                                tflite::Interpreter* src, int32_t src_id, const std::string& producer,
+                                tflite::Interpreter* dst, int32_t dst_id, const std::string& consumer) {
+    const size_t bytes = src->tensor(src_id)->bytes;
+    if (bytes != dst->tensor(dst_id)->bytes) {
+        fprintf(stderr, "Zero-copy: the %s tensors have different sizes, the %s is copied\n", name, name);
+        return false;
+    }
+
+    void* data = nullptr;
+    const size_t aligned_bytes = (bytes + k_tensor_alignment - 1) / k_tensor_alignment * k_tensor_alignment;
+    AUDIOGEN_CHECK(posix_memalign(&data, k_tensor_alignment, aligned_bytes) == 0);
+
+    AudioGenSharedBuffer buffer;
+    buffer.name = name;
+    buffer.producer = producer;
+    buffer.consumer = consumer;
+    buffer.bytes = bytes;
+    buffer.data.reset(data);
+
+    const TfLiteCustomAllocation allocation = {data, aligned_bytes};
+    AUDIOGEN_CHECK(src->SetCustomAllocationForTensor(src_id, allocation) == kTfLiteOk);
+    AUDIOGEN_CHECK(dst->SetCustomAllocationForTensor(dst_id, allocation) == kTfLiteOk);
+
+    models.shared_buffers.push_back(std::move(buffer));
+    return true;
+}
+
+static void share_stage_buffers(AudioGenModels& models) {
+    tflite::Interpreter* t5_interpreter = models.t5_interpreter.get();
+    tflite::Interpreter* dit_interpreter = models.dit_interpreter.get();
+    tflite::Interpreter* autoencoder_interpreter = models.autoencoder_interpreter.get();
+
+    const int32_t t5_crossattn_out_id = t5_interpreter->outputs()[k_t5_crossattn_out_idx];
+    const int32_t t5_globalcond_out_id = t5_interpreter->outputs()[k_t5_globalcond_out_idx];
+    const int32_t dit_crossattn_in_id = dit_interpreter->inputs()[k_dit_crossattn_in_idx];
+    const int32_t dit_globalcond_in_id = dit_interpreter->inputs()[k_dit_globalcond_in_idx];
+    const int32_t dit_x_in_id = dit_interpreter->inputs()[k_dit_x_in_idx];
+    const int32_t autoencoder_in_id = autoencoder_interpreter->inputs()[0];
+
+    share_tensor_buffer(models, "cross-attention conditioning",
+                        t5_interpreter, t5_crossattn_out_id, describe_tensor("T5", "output", k_t5_crossattn_out_idx, t5_interpreter->tensor(t5_crossattn_out_id)),
+                        dit_interpreter, dit_crossattn_in_id, describe_tensor("DiT", "input", k_dit_crossattn_in_idx, dit_interpreter->tensor(dit_crossattn_in_id)));
+
+    share_tensor_buffer(models, "global conditioning",
+                        t5_interpreter, t5_globalcond_out_id, describe_tensor("T5", "output", k_t5_globalcond_out_idx, t5_interpreter->tensor(t5_globalcond_out_id)),
+                        dit_interpreter, dit_globalcond_in_id, describe_tensor("DiT", "input", k_dit_globalcond_in_idx, dit_interpreter->tensor(dit_globalcond_in_id)));
+
+    // The sampler updates the DiT x input in place, so after the last step it holds the final latent
+    share_tensor_buffer(models, "latent",
+                        dit_interpreter, dit_x_in_id, describe_tensor("DiT", "input", k_dit_x_in_idx, dit_interpreter->tensor(dit_x_in_id)),
+                        autoencoder_interpreter, autoencoder_in_id, describe_tensor("Autoencoder", "input", 0, autoencoder_interpreter->tensor(autoencoder_in_id)));
+
+    AUDIOGEN_CHECK(t5_interpreter->AllocateTensors() == kTfLiteOk);
+    AUDIOGEN_CHECK(dit_interpreter->AllocateTensors() == kTfLiteOk);
+    AUDIOGEN_CHECK(autoencoder_interpreter->AllocateTensors() == kTfLiteOk);
+}
+
+void print_shared_buffers(FILE* out, const std::vector<AudioGenSharedBuffer>& shared_buffers) {
+    size_t total_bytes = 0;
+
+    fprintf(out, "Zero-copy memory layout:\n");
+    for (const AudioGenSharedBuffer& buffer : shared_buffers) {
+        const uintptr_t begin = reinterpret_cast<uintptr_t>(buffer.data.get());
+        fprintf(out, "  %-28s %9zu bytes [0x%" PRIxPTR ", 0x%" PRIxPTR ")\n", buffer.name.c_str(), buffer.bytes, begin, begin + buffer.bytes);
+        fprintf(out, "    written by %s\n", buffer.producer.c_str());
+        fprintf(out, "    read by    %s\n", buffer.consumer.c_str());
+        total_bytes += buffer.bytes;
+    }
+    fprintf(out, "  Copies avoided per generation: %zu bytes\n", total_bytes);
+}
+
+// Resize the time dimension of the autoencoder input, the last one
+static void resize_autoencoder(AudioGenModels& models, size_t latent_len) {
+    if (models.autoencoder_latent_len == latent_len) {
+        return;
+    }
+
+    tflite::Interpreter* autoencoder_interpreter = models.autoencoder_interpreter.get();
+    const int32_t autoencoder_in_id = autoencoder_interpreter->inputs()[0];
+    const TfLiteIntArray* autoencoder_in_dims = autoencoder_interpreter->tensor(autoencoder_in_id)->dims;
+
+    std::vector<int32_t> new_dims(autoencoder_in_dims->data, autoencoder_in_dims->data + autoencoder_in_dims->size);
+    new_dims.back() = static_cast<int32_t>(latent_len);
+    AUDIOGEN_CHECK(autoencoder_interpreter->ResizeInputTensor(autoencoder_in_id, new_dims) == kTfLiteOk);
+    AUDIOGEN_CHECK(autoencoder_interpreter->AllocateTensors() == kTfLiteOk);
+    models.autoencoder_latent_len = latent_len;
+}
+
+// ----- Low-memory mode
+// Load T5 or the autoencoder again if it was released, and add the time spent to timings.load
+static void acquire_t5(AudioGenModels& models, AudioGenTimings& timings) {
+    if (models.t5_interpreter != nullptr) {
+        return;
+    }
+    auto start_load = time_in_ms();
+    load_stage(models, models.t5_params, models.t5_model_memory,
+               models.t5_model, models.xnnpack_delegate_t5, models.t5_interpreter, models.t5_profiler.get(), models.startup.t5);
+    timings.load += time_in_ms() - start_load;
+}
+
+static void acquire_autoencoder(AudioGenModels& models, AudioGenTimings& timings) {
+    if (models.autoencoder_interpreter != nullptr) {
+        return;
+    }
+    auto start_load = time_in_ms();
+    load_stage(models, models.autoencoder_params, models.autoencoder_model_memory,
+               models.autoencoder_model, models.xnnpack_delegate_autoencoder, models.autoencoder_interpreter, models.autoencoder_profiler.get(),
+               models.startup.autoencoder);
+    models.autoencoder_latent_len = models.max_latent_len;
+    timings.load += time_in_ms() - start_load;
+}
+
+// In the low-memory mode, free T5 or the autoencoder. The interpreter refers to the delegate
+// and to the model, so it is released first
+static void release_t5(AudioGenModels& models) {
+    if (models.low_memory) {
+        models.t5_interpreter.reset();
+        models.xnnpack_delegate_t5.reset();
+        models.t5_model.reset();
+        models.t5_model_memory.reset();
+    }
+}
+
+static void release_autoencoder(AudioGenModels& models) {
+    if (models.low_memory) {
+        models.autoencoder_interpreter.reset();
+        models.xnnpack_delegate_autoencoder.reset();
+        models.autoencoder_model.reset();
+        models.autoencoder_model_memory.reset();
+    }
+}
+
+// ----- Shared-arena mode
+// Allocate the tensors of a stage again once release_arena() has freed them. It does nothing
+// when they are allocated
+static void acquire_arena(const AudioGenModels& models, tflite::Interpreter* interpreter) {
+    if (models.shared_arena) {
+        AUDIOGEN_CHECK(interpreter->AllocateTensors() == kTfLiteOk);
+    }
+}
+
+// Free the activations of a stage, including its input and output tensors, so that the next
+// stage allocates its own in the same memory
+static void release_arena(const AudioGenModels& models, tflite::Interpreter* interpreter) {
+    if (models.shared_arena && interpreter != nullptr) {
+        AUDIOGEN_CHECK(interpreter->ReleaseNonPersistentMemory() == kTfLiteOk);
+    }
+}
+
+// The XNNPack options of a delegate are the same for all the stages, except the number of threads,
+// the fp16 flag and the weight cache file. A shared delegate also needs the same CPUs, since its
+// threads keep the affinity they are created with
+static bool can_share_delegate(const AudioGenModels& models) {
+    const AudioGenStageParams& dit = models.dit_params;
+    for (const AudioGenStageParams* params : {&models.t5_params, &models.autoencoder_params}) {
+        if (params->xnnpack_options.num_threads != dit.xnnpack_options.num_threads || params->cpus != dit.cpus ||
+            (params->precision == AudioGenPrecision::fp16) != (dit.precision == AudioGenPrecision::fp16)) {
+            return false;
+        }
+    }
+    return dit.weight_cache_dir.empty();
+}
+
+// Peak resident set size of the process, in kB, since the start or the last reset_peak_rss()
+static size_t get_peak_rss_kb() {
+    return read_proc_kb("/proc/self/status", "VmHWM:");
+}
+
+static size_t get_rss_kb() {
+    return read_proc_kb("/proc/self/status", "VmRSS:");
+}
+
+// Writing 5 to clear_refs resets the peak resident set size of the process on Linux
+static void reset_peak_rss() {
+    std::ofstream clear_refs_file("/proc/self/clear_refs");
+    clear_refs_file << "5";
+}
+
+void load_models(AudioGenModels& models, const std::string& models_base_path, const AudioGenConfig& config) {
+
+    const AudioGenPrecisions& precisions = config.precisions;
+    models.t5_params.model_path = get_stage_model_path(models_base_path, "conditioners", "conditioners_float32.tflite", precisions.t5);
+    models.dit_params.model_path = get_stage_model_path(models_base_path, "dit_model", "dit_model.tflite", precisions.dit);
+    models.autoencoder_params.model_path = get_stage_model_path(models_base_path, "autoencoder_model", "autoencoder_model.tflite", precisions.autoencoder);
+    models.sentence_model_path = models_base_path + "/spiece.model";
+
+    // Create the XNNPACK delegate options
+    TfLiteXNNPackDelegateOptions xnnpack_options = TfLiteXNNPackDelegateOptionsDefault();
+
+    xnnpack_options.flags |= TFLITE_XNNPACK_DELEGATE_FLAG_QS8;
+    xnnpack_options.flags |= TFLITE_XNNPACK_DELEGATE_FLAG_QU8;
+    xnnpack_options.flags |= TFLITE_XNNPACK_DELEGATE_FLAG_DYNAMIC_FULLY_CONNECTED;
+    xnnpack_options.flags |= TFLITE_XNNPACK_DELEGATE_FLAG_ENABLE_SUBGRAPH_RESHAPING;
+    xnnpack_options.flags |= TFLITE_XNNPACK_DELEGATE_FLAG_ENABLE_LATEST_OPERATORS;
+    xnnpack_options.flags |= TFLITE_XNNPACK_DELEGATE_FLAG_VARIABLE_OPERATORS;
+
+    // When a stage is pinned, the other ones run on all the CPUs, so that they do not inherit
+    // the affinity of the previous stage of the same thread
+    models.affinity = config.affinity;
+    AudioGenAffinity& affinity = models.affinity;
+    if (!affinity.t5.empty() || !affinity.dit.empty() || !affinity.autoencoder.empty()) {
+        std::vector<int32_t> all_cpus;
+        for (const AudioGenCpuCluster& cluster : get_cpu_clusters()) {
+            all_cpus.insert(all_cpus.end(), cluster.cpus.begin(), cluster.cpus.end());
+        }
+        std::sort(all_cpus.begin(), all_cpus.end());
+        for (std::vector<int32_t>* cpus : {&affinity.t5, &affinity.dit, &affinity.autoencoder}) {
+            if (cpus->empty()) {
+                *cpus = all_cpus;
+            }
+        }
+    }
+
+    if (config.profile) {
+        models.t5_profiler = std::make_unique<tflite::profiling::BufferedProfiler>(k_profiler_initial_events, true);
+        models.dit_profiler = std::make_unique<tflite::profiling::BufferedProfiler>(k_profiler_initial_events, true);
+        models.autoencoder_profiler = std::make_unique<tflite::profiling::BufferedProfiler>(k_profiler_initial_events, true);
+    }
+
+    // The fp16 precision adds TFLITE_XNNPACK_DELEGATE_FLAG_FORCE_FP16 to the options of its stage.
+    // By default, only the autoencoder, the most computationally expensive model, runs in fp16
+    const auto set_params = [&](AudioGenStageParams& params, AudioGenPrecision precision, const std::vector<int32_t>& cpus, size_t num_threads) {
+        params.precision = precision;
+        params.cpus = cpus;
+        params.xnnpack_options = xnnpack_options;
+        params.xnnpack_options.num_threads = num_threads;
+        params.weight_cache_dir = config.weight_cache_dir;
+        params.huge_pages = config.huge_pages;
+        params.numa_node = config.numa_bind ? get_numa_node(cpus) : -1;
+        if (config.numa_bind && cpus.empty()) {
+            fprintf(stderr, "WARNING: the stages are not pinned to CPUs, so they are not bound to a NUMA node\n");
+        } else if (config.numa_bind && params.numa_node < 0) {
+            fprintf(stderr, "WARNING: the CPUs %s are not on a single NUMA node, their stage is not bound\n", format_cpu_list(cpus).c_str());
+        }
+    };
+    set_params(models.t5_params, precisions.t5, affinity.t5, config.threads.t5);
+    set_params(models.dit_params, precisions.dit, affinity.dit, config.threads.dit);
+    set_params(models.autoencoder_params, precisions.autoencoder, affinity.autoencoder, config.threads.autoencoder);
+
+    // The low-memory mode still loads every stage once, to read the shapes of the models
+    AUDIOGEN_CHECK(!config.low_memory || (!config.zero_copy && !config.profile));
+    models.low_memory = config.low_memory;
+
+    // The low-memory mode drops the pages of the model files, which an anonymous copy does not have
+    AUDIOGEN_CHECK(!config.low_memory || config.huge_pages == AudioGenHugePages::none);
+    models.startup.huge_pages = config.huge_pages;
+
+    // The zero-copy mode keeps the conditioning and the latent in the arenas of the stages
+    AUDIOGEN_CHECK(!config.shared_arena || !config.zero_copy);
+    models.shared_arena = config.shared_arena;
+    models.startup.shared_arena = config.shared_arena;
+    if (config.shared_arena && can_share_delegate(models)) {
+        // A single XNNPack workspace holds the activations of the delegated operators of the
+        // three stages, which never run at the same time
+        TfLiteXNNPackDelegateOptions shared_options = models.dit_params.xnnpack_options;
+        if (models.dit_params.precision == AudioGenPrecision::fp16) {
+            shared_options.flags |= TFLITE_XNNPACK_DELEGATE_FLAG_FORCE_FP16;
+        }
+        const std::vector<int32_t> load_cpus = get_thread_affinity();
+        set_thread_affinity(models.dit_params.cpus);
+        models.xnnpack_delegate_shared.reset(TfLiteXNNPackDelegateCreate(&shared_options));
+        set_thread_affinity(load_cpus);
+        AUDIOGEN_CHECK(models.xnnpack_delegate_shared != nullptr);
+        models.startup.shared_delegate = true;
+    }
+
+    // The files are read from the storage while the first model is parsed and delegated
+    models.startup.start_time = time_in_ms();
+    for (const std::string& path : {models.t5_params.model_path, models.dit_params.model_path,
+                                    models.autoencoder_params.model_path, models.sentence_model_path}) {
+        prefetch_file(path);
+    }
+    models.startup.prefetch = time_in_ms() - models.startup.start_time;
+
+    // The tokenizer is loaded along with T5, which gives its sequence length
+    const auto load_t5 = [&models]() {
+        load_stage(models, models.t5_params, models.t5_model_memory,
+                   models.t5_model, models.xnnpack_delegate_t5, models.t5_interpreter, models.t5_profiler.get(), models.startup.t5);
+
+        auto start_tokenizer = time_in_ms();
+        tflite::Interpreter* t5_interpreter = models.t5_interpreter.get();
+        const TfLiteIntArray* t5_ids_in_dims = t5_interpreter->tensor(t5_interpreter->inputs()[k_t5_ids_in_idx])->dims;
+        const TfLiteIntArray* t5_attnmask_in_dims = t5_interpreter->tensor(t5_interpreter->inputs()[k_t5_attnmask_in_idx])->dims;
+        AUDIOGEN_CHECK(get_num_elems(t5_ids_in_dims) == get_num_elems(t5_attnmask_in_dims));
+        models.tokenizer.load(models.sentence_model_path, get_num_elems(t5_ids_in_dims));
+        models.startup.tokenizer = time_in_ms() - start_tokenizer;
+    };
+    const auto load_dit = [&models]() {
+        load_stage(models, models.dit_params, models.dit_model_memory,
+                   models.dit_model, models.xnnpack_delegate_dit, models.dit_interpreter, models.dit_profiler.get(), models.startup.dit);
+    };
+    const auto load_autoencoder = [&models]() {
+        load_stage(models, models.autoencoder_params, models.autoencoder_model_memory,
+                   models.autoencoder_model, models.xnnpack_delegate_autoencoder, models.autoencoder_interpreter, models.autoencoder_profiler.get(),
+                   models.startup.autoencoder);
+    };
+
+    // The stages are independent until their first Invoke, and each one only writes its own
+    // members. The op resolver is only read, but a shared delegate is not applied concurrently.
+    // With huge pages, a stage collapses all the anonymous mappings created during its load, so
+    // the stages are loaded one after another to only collapse and count their own buffers
+    models.startup.parallel = config.parallel_load && !config.low_memory && !models.startup.shared_delegate &&
+                              config.huge_pages == AudioGenHugePages::none;
+    if (models.startup.parallel) {
+        // A failed load is raised again once all the loader threads are joined
+        std::exception_ptr errors[3];
+        const auto catch_error = [](const std::function<void()>& load, std::exception_ptr& error) {
+            try {
+                load();
+            } catch (...) {
+                error = std::current_exception();
+            }
+        };
+        std::thread t5_thread(catch_error, load_t5, std::ref(errors[0]));
+        std::thread autoencoder_thread(catch_error, load_autoencoder, std::ref(errors[1]));
+        catch_error(load_dit, errors[2]);
+        t5_thread.join();
+        autoencoder_thread.join();
+        for (const std::exception_ptr& error : errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+    } else {
+        load_t5();
+        load_dit();
+        load_autoencoder();
+    }
+
+    const std::vector<int32_t> dit_cpus = models.affinity.dit;
+    models.sampler_pool = std::make_unique<AudioGenThreadPool>(config.threads.dit, [dit_cpus]() { set_thread_affinity(dit_cpus); });
+
+    tflite::Interpreter* dit_interpreter = models.dit_interpreter.get();
+    models.dit_crossattn_sz = get_num_elems(dit_interpreter->tensor(dit_interpreter->inputs()[k_dit_crossattn_in_idx])->dims);
+    models.dit_globalcond_sz = get_num_elems(dit_interpreter->tensor(dit_interpreter->inputs()[k_dit_globalcond_in_idx])->dims);
+
+    // The latent is stored as [1, channels, frames] and the audio as [1, 2, samples]
+    tflite::Interpreter* autoencoder_interpreter = models.autoencoder_interpreter.get();
+    const int32_t autoencoder_in_id = autoencoder_interpreter->inputs()[0];
+    const TfLiteIntArray* autoencoder_in_dims = autoencoder_interpreter->tensor(autoencoder_in_id)->dims;
+    const TfLiteIntArray* autoencoder_out_dims = autoencoder_interpreter->tensor(autoencoder_interpreter->outputs()[0])->dims;
+
+    models.max_latent_len = autoencoder_in_dims->data[autoencoder_in_dims->size - 1];
+    models.latent_channels = get_num_elems(autoencoder_in_dims) / models.max_latent_len;
+    models.samples_per_frame = get_num_elems(autoencoder_out_dims) / 2 / models.max_latent_len;
+    models.dit_latent_len = models.max_latent_len;
+    models.autoencoder_latent_len = models.max_latent_len;
+
+    if (config.cond_cache_entries > 0) {
+        models.cond_cache.configure(config.cond_cache_entries, config.cond_cache_dir, models.dit_crossattn_sz, models.dit_globalcond_sz);
+    }
+
+    if (config.zero_copy) {
+        share_stage_buffers(models);
+    }
+
+    if (config.decode_chunk_len > 0 && config.decode_chunk_len < models.max_latent_len) {
+        AUDIOGEN_CHECK(!config.zero_copy);
+        AUDIOGEN_CHECK(config.decode_chunk_len > 2 * config.decode_overlap);
+        models.decode_chunk_len = config.decode_chunk_len;
+        models.decode_overlap = config.decode_overlap;
+        resize_autoencoder(models, models.decode_chunk_len);
+    }
+
+    AUDIOGEN_CHECK(config.segment_overlap_sec >= 0.0f && config.segment_overlap_sec < k_audio_len_sec / 2);
+    models.segment_overlap_sec = config.segment_overlap_sec;
+
+    release_t5(models);
+    release_autoencoder(models);
+
+    // Between two generations, no stage holds its activations
+    release_arena(models, models.t5_interpreter.get());
+    release_arena(models, models.dit_interpreter.get());
+    release_arena(models, models.autoencoder_interpreter.get());
+
+    if (config.huge_pages != AudioGenHugePages::none) {
+        models.startup.thp_kb = read_proc_kb("/proc/self/smaps_rollup", "AnonHugePages:");
+        models.startup.hugetlb_kb = read_proc_kb("/proc/self/smaps_rollup", "Private_Hugetlb:");
+    }
+
+    models.startup.total = time_in_ms() - models.startup.start_time;
+}
+
+void print_cond_cache_stats(FILE* out, const AudioGenCondCacheStats& stats) {
+    fprintf(out, "Conditioning cache: %zu hits, %zu disk hits, %zu misses, %zu entries, %zu bytes\n",
+            stats.hits, stats.disk_hits, stats.misses, stats.entries, stats.bytes);
+}
+
+void print_startup_report(FILE* out, const AudioGenStartup& startup) {
+    auto print_stage = [out](const char* name, const AudioGenStageStartup& stage) {
+        const long end = stage.start + stage.load + stage.build + stage.delegate + stage.allocate;
+        fprintf(out, "%-12s %-4s %5ld -> %5ld ms, load: %5ld ms, build: %5ld ms, delegate: %6ld ms, allocate: %5ld ms",
+                name, get_precision_name(stage.precision), stage.start, end, stage.load, stage.build, stage.delegate, stage.allocate);
+        if (stage.int8_weights) {
+            fprintf(out, " (int8 weights)");
+        }
+        if (!stage.weight_cache_path.empty()) {
+            fprintf(out, " (weight cache %s: %s)", stage.weight_cache_hit ? "hit" : "created", stage.weight_cache_path.c_str());
+        }
+        if (stage.huge_pages != AudioGenHugePages::none) {
+            fprintf(out, " (model in %s pages, %zu MB packed in huge pages)", get_huge_pages_name(stage.huge_pages), stage.collapsed_bytes >> 20);
+        }
+        if (stage.numa_node >= 0) {
+            fprintf(out, " (NUMA node %d)", stage.numa_node);
+        }
+        fprintf(out, "\n");
+    };
+
+    fprintf(out, "Start-up (%s, read-ahead requested in %ld ms):\n", startup.parallel ? "parallel" : "sequential", startup.prefetch);
+    print_stage("T5", startup.t5);
+    print_stage("DiT", startup.dit);
+    print_stage("Autoencoder", startup.autoencoder);
+    fprintf(out, "Tokenizer: %ld ms\n", startup.tokenizer);
+    if (startup.huge_pages != AudioGenHugePages::none) {
+        fprintf(out, "Huge pages: %zu MB transparent, %zu MB hugetlb\n", startup.thp_kb / 1024, startup.hugetlb_kb / 1024);
+    }
+    if (startup.shared_arena) {
+        fprintf(out, "Shared arena: %s\n", startup.shared_delegate ? "one XNNPack delegate for the three stages"
+                                                                   : "one XNNPack delegate per stage, whose threads, CPUs, fp16 or weight cache differ");
+    }
+    fprintf(out, "Start-up total: %ld ms\n", startup.total);
+}
+
+float get_max_audio_len_sec(const AudioGenModels& models) {
+    return static_cast<float>(models.max_latent_len * models.samples_per_frame) / k_audio_sample_rate;
+}
+
+size_t get_latent_len(const AudioGenModels& models, const AudioGenJob& job) {
+    // The default length keeps the latent the models were exported with
+    if (job.audio_len_sec >= k_audio_len_sec) {
+        return models.max_latent_len;
+    }
+
+    const size_t num_samples = static_cast<size_t>(std::ceil(job.audio_len_sec * k_audio_sample_rate));
+    const size_t num_frames = (num_samples + models.samples_per_frame - 1) / models.samples_per_frame;
+    const size_t latent_len = (num_frames + k_latent_len_align - 1) / k_latent_len_align * k_latent_len_align;
+    return std::min(std::max(latent_len, k_latent_len_align), models.max_latent_len);
+}
+
+size_t get_num_audio_samples(const AudioGenModels& models, const AudioGenJob& job) {
+    const size_t num_samples = static_cast<size_t>(std::lround(job.audio_len_sec * k_audio_sample_rate));
+    return std::min(num_samples, get_latent_len(models, job) * models.samples_per_frame);
+}
+
+// Resize the batch dimension of the DiT inputs, and the time dimension of the x input. The DiT
+// model is exported with a batch of one and the longest latent, and the XNNPack delegate reshapes
+// its subgraph when the inputs change thanks to TFLITE_XNNPACK_DELEGATE_FLAG_ENABLE_SUBGRAPH_RESHAPING
+void resize_dit_inputs(AudioGenModels& models, size_t batch_sz, size_t latent_len) {
+    if (models.dit_batch_sz == batch_sz && models.dit_latent_len == latent_len) {
+        return;
+    }
+
+    // The shared buffers are sized for a single batch item. A shorter latent fits in them
+    AUDIOGEN_CHECK(models.shared_buffers.empty() || batch_sz == 1);
+
+    tflite::Interpreter* dit_interpreter = models.dit_interpreter.get();
+
+    for (size_t in_idx : {k_dit_crossattn_in_idx, k_dit_globalcond_in_idx, k_dit_x_in_idx, k_dit_t_in_idx}) {
+        const int32_t in_id = dit_interpreter->inputs()[in_idx];
+        const TfLiteIntArray* in_dims = dit_interpreter->tensor(in_id)->dims;
+        AUDIOGEN_CHECK(in_dims->size > 0);
+
+        std::vector<int32_t> new_dims(in_dims->data, in_dims->data + in_dims->size);
+        new_dims[0] = static_cast<int32_t>(batch_sz);
+        if (in_idx == k_dit_x_in_idx) {
+            new_dims.back() = static_cast<int32_t>(latent_len);
+        }
+        AUDIOGEN_CHECK(dit_interpreter->ResizeInputTensor(in_id, new_dims) == kTfLiteOk);
+    }
+
+    AUDIOGEN_CHECK(dit_interpreter->AllocateTensors() == kTfLiteOk);
+    models.dit_batch_sz = batch_sz;
+    models.dit_latent_len = latent_len;
+}
+
+// ----- Stage 1: tokenizer and T5
+// Write the cross-attention and global conditioning of each job at
+// crossattn_data[b * dit_crossattn_sz] and globalcond_data[b * dit_globalcond_sz]
+void run_conditioners(AudioGenModels& models, const std::vector<AudioGenJob>& jobs, float* crossattn_data, float* globalcond_data, AudioGenTimings& timings) {
+    set_thread_affinity(models.affinity.t5);
+
+    const size_t crossattn_sz = models.dit_crossattn_sz;
+    const size_t globalcond_sz = models.dit_globalcond_sz;
+
+    AudioGenCondCache& cond_cache = models.cond_cache;
+
+    // Seed variations of the same prompt share the same conditioning, and the prompts already seen
+    // skip the tokenizer. The other prompts are tokenized together
+    std::vector<size_t> encoded_jobs;
+    std::vector<const std::string*> prompts;
+    for (size_t b = 0; b < jobs.size(); ++b) {
+        if (b > 0 && jobs[b].prompt == jobs[b - 1].prompt) {
+            continue;
+        }
+
+        if (cond_cache.enabled() && cond_cache.find_prompt(jobs[b].prompt, jobs[b].audio_len_sec,
+                                                           crossattn_data + b * crossattn_sz, globalcond_data + b * globalcond_sz)) {
+            ++timings.cond_cache_hits;
+            continue;
+        }
+        encoded_jobs.push_back(b);
+        prompts.push_back(&jobs[b].prompt);
+    }
+
+    auto start_tokenizer = time_in_ms();
+
+    // Convert the prompts to IDs
+    std::vector<std::vector<int32_t>> prompt_ids;
+    models.tokenizer.encode_batch(prompts, prompt_ids);
+
+    auto end_tokenizer = time_in_ms();
+
+    timings.tokenizer += (end_tokenizer - start_tokenizer);
+
+    for (size_t e = 0; e < encoded_jobs.size(); ++e) {
+        const size_t b = encoded_jobs[e];
+        const std::vector<int32_t>& ids = prompt_ids[e];
+        float* crossattn_dst = crossattn_data + b * crossattn_sz;
+        float* globalcond_dst = globalcond_data + b * globalcond_sz;
+
+        if (cond_cache.enabled() && cond_cache.find_ids(jobs[b].prompt, ids, jobs[b].audio_len_sec, crossattn_dst, globalcond_dst)) {
+            ++timings.cond_cache_hits;
+            continue;
+        }
+
+        // In the low-memory mode, T5 is only loaded when a prompt misses the conditioning cache
+        acquire_t5(models, timings);
+
+        tflite::Interpreter* t5_interpreter = models.t5_interpreter.get();
+        acquire_arena(models, t5_interpreter);
+
+        const size_t t5_ids_in_id = t5_interpreter->inputs()[k_t5_ids_in_idx];
+        const size_t t5_attnmask_in_id = t5_interpreter->inputs()[k_t5_attnmask_in_idx];
+        const size_t t5_time_in_id = t5_interpreter->inputs()[k_t5_audio_len_in_idx];
+
+        int64_t* t5_ids_in_data = t5_interpreter->typed_tensor<int64_t>(t5_ids_in_id);
+        int64_t* t5_attnmask_in_data = t5_interpreter->typed_tensor<int64_t>(t5_attnmask_in_id);
+        float* t5_time_in_data = t5_interpreter->typed_tensor<float>(t5_time_in_id);
+        const float* t5_crossattn_out_data = t5_interpreter->typed_tensor<float>(t5_interpreter->outputs()[k_t5_crossattn_out_idx]);
+        const float* t5_globalcond_out_data = t5_interpreter->typed_tensor<float>(t5_interpreter->outputs()[k_t5_globalcond_out_idx]);
+
+        // Initialize the t5_ids_in_data and the t5_attnmask_in_data
+        models.tokenizer.write_t5_inputs(ids, t5_ids_in_data, t5_attnmask_in_data);
+
+        // Initialize the t5_time_in_data
+        memcpy(t5_time_in_data, &jobs[b].audio_len_sec, 1 * sizeof(float));
+
+        auto start_t5 = time_in_ms();
+
+        // Run T5
+        AUDIOGEN_CHECK(t5_interpreter->Invoke() == kTfLiteOk);
+
+        auto end_t5 = time_in_ms();
+
+        // In zero-copy mode, T5 has already written the conditioning to its destination
+        if (crossattn_dst != t5_crossattn_out_data) {
+            memcpy(crossattn_dst, t5_crossattn_out_data, crossattn_sz * sizeof(float));
+        }
+        if (globalcond_dst != t5_globalcond_out_data) {
+            memcpy(globalcond_dst, t5_globalcond_out_data, globalcond_sz * sizeof(float));
+        }
+
+        if (cond_cache.enabled()) {
+            cond_cache.insert(jobs[b].prompt, ids, jobs[b].audio_len_sec, crossattn_dst, globalcond_dst);
+        }
+
+        timings.t5 += (end_t5 - start_t5);
+    }
+
+    // The seed variations are copied in order, so that a run of the same prompt copies the first one
+    for (size_t b = 1; b < jobs.size(); ++b) {
+        if (jobs[b].prompt == jobs[b - 1].prompt) {
+            float* crossattn_dst = crossattn_data + b * crossattn_sz;
+            float* globalcond_dst = globalcond_data + b * globalcond_sz;
+            memcpy(crossattn_dst, crossattn_dst - crossattn_sz, crossattn_sz * sizeof(float));
+            memcpy(globalcond_dst, globalcond_dst - globalcond_sz, globalcond_sz * sizeof(float));
+        }
+    }
+
+    for (size_t b = 0; b < jobs.size(); ++b) {
+        if (jobs[b].observer.on_conditioning) {
+            jobs[b].observer.on_conditioning(crossattn_data + b * crossattn_sz, crossattn_sz, globalcond_data + b * globalcond_sz, globalcond_sz);
+        }
+    }
+
+    release_arena(models, models.t5_interpreter.get());
+    release_t5(models);
+}
+
+const char* get_sampler_name(AudioGenSampler sampler) {
+    switch (sampler) {
+        case AudioGenSampler::euler: return "euler";
+        case AudioGenSampler::dpmpp_2m: return "dpmpp-2m";
+        default: return "ping-pong";
+    }
+}
+
+bool parse_sampler(const std::string& name, AudioGenSampler& sampler) {
+    for (AudioGenSampler s : {AudioGenSampler::ping_pong, AudioGenSampler::euler, AudioGenSampler::dpmpp_2m}) {
+        if (name == get_sampler_name(s)) {
+            sampler = s;
+            return true;
+        }
+    }
+    return false;
+}
+
+// ----- Stage 2: diffusion
+// The DiT conditioning inputs must be initialized and the DiT batch size must match
+// the number of jobs. The final latents are left in the DiT x input
+void run_diffusion(AudioGenModels& models, const std::vector<AudioGenJob>& jobs, AudioGenTimings& timings) {
+    // The threads of the sampler pool are pinned to the CPUs of the DiT when they start
+    set_thread_affinity(models.affinity.dit);
+
+    tflite::Interpreter* dit_interpreter = models.dit_interpreter.get();
+
+    const size_t batch_sz = jobs.size();
+    const size_t num_steps = jobs[0].num_steps;
+    const size_t dit_x_sz = models.latent_channels * models.dit_latent_len;
+
+    AUDIOGEN_CHECK(models.dit_batch_sz == batch_sz);
+    AUDIOGEN_CHECK(models.dit_latent_len == get_latent_len(models, jobs[0]));
+
+    float* dit_x_in_data = dit_interpreter->typed_tensor<float>(dit_interpreter->inputs()[k_dit_x_in_idx]);
+    float* dit_t_in_data = dit_interpreter->typed_tensor<float>(dit_interpreter->inputs()[k_dit_t_in_idx]);
+    float* dit_out_data = dit_interpreter->typed_tensor<float>(dit_interpreter->outputs()[k_dit_out_idx]);
+
+    // The sampler updates the whole batch at once, with the noise of each latent from its own seed
+    AudioGenThreadPool* sampler_pool = models.sampler_pool.get();
+    std::vector<uint64_t> seeds(batch_sz);
+    for (size_t b = 0; b < batch_sz; ++b) {
+        seeds[b] = jobs[b].seed;
+    }
+
+    // ----- Allocate the extra buffer to pre-compute the sigmas
+    std::vector<float> t_buffer(num_steps + 1);
+
+    // ----- Initialize the T and X buffers
+    for (size_t b = 0; b < batch_sz; ++b) {
+        if (!jobs[b].init_noise.empty()) {
+            AUDIOGEN_CHECK(jobs[b].init_noise.size() == dit_x_sz);
+            memcpy(dit_x_in_data + b * dit_x_sz, jobs[b].init_noise.data(), dit_x_sz * sizeof(float));
+            continue;
+        }
+        fill_random_norm_dist(dit_x_in_data + b * dit_x_sz, dit_x_sz, jobs[b].seed, k_rng_stream_init, sampler_pool);
+    }
+    fill_sigmas(t_buffer, jobs[0].logsnr_start, jobs[0].logsnr_end);
+
+    tflite::Profiler* dit_profiler = models.dit_profiler.get();
+
+    // Adaptive schedule: previous denoised estimate of the whole batch, and whether the next step
+    // extrapolates the last two estimates instead of running the DiT
+    const float adaptive_threshold = jobs[0].adaptive_threshold;
+    const AudioGenSampler sampler = jobs[0].sampler;
+    AUDIOGEN_CHECK(adaptive_threshold == 0.0f || sampler == AudioGenSampler::ping_pong);
+
+    // The DPM-Solver++(2M) sampler also keeps the previous denoised estimate
+    const bool keep_denoised = adaptive_threshold > 0.0f || sampler == AudioGenSampler::dpmpp_2m;
+    std::vector<float> prev_denoised(keep_denoised ? batch_sz * dit_x_sz : 0);
+    bool extrapolate_next = false;
+
+    timings.dit_steps_run = 0;
+    timings.dit_steps_saved = 0;
+    timings.dit_step.clear();
+
+    const auto observe_step = [&](size_t step) {
+        for (size_t b = 0; b < batch_sz; ++b) {
+            if (jobs[b].observer.on_dit_step) {
+                jobs[b].observer.on_dit_step(step, dit_x_in_data + b * dit_x_sz, dit_x_sz);
+            }
+        }
+    };
+
+    auto start_dit = time_in_ms();
+
+    for(size_t i = 0; i < num_steps; ++i) {
+        const float curr_t = t_buffer[i];
+        const float next_t = t_buffer[i + 1];
+        std::fill(dit_t_in_data, dit_t_in_data + batch_sz, curr_t);
+
+        const long start_step = time_in_us();
+        uint32_t step_event = 0;
+        if (dit_profiler != nullptr) {
+            step_event = dit_profiler->BeginEvent(k_dit_step_event_tag, tflite::Profiler::EventType::DEFAULT, i, 0);
+        }
+
+        if (extrapolate_next) {
+            // The estimates are extrapolated linearly in t, from the steps i - 2 and i - 1
+            const float ratio = (curr_t - t_buffer[i - 1]) / (t_buffer[i - 1] - t_buffer[i - 2]);
+            sampler_extrapolate(prev_denoised.data(), dit_out_data, dit_x_in_data, dit_x_sz, ratio, next_t, i, seeds, sampler_pool);
+            extrapolate_next = false;
+            ++timings.dit_steps_saved;
+        } else {
+            if (adaptive_threshold > 0.0f && i > 0) {
+                memcpy(prev_denoised.data(), dit_out_data, prev_denoised.size() * sizeof(float));
+            }
+
+            // Run DiT
+            AUDIOGEN_CHECK(dit_interpreter->Invoke() == kTfLiteOk);
+            ++timings.dit_steps_run;
+
+            // The output of DiT is combined with the current x and t tensors to
+            // generate the next x tensor for DiT, in one pass over the whole batch
+            switch (sampler) {
+                case AudioGenSampler::euler:
+                    sampler_euler(dit_out_data, dit_x_in_data, batch_sz * dit_x_sz, curr_t, next_t, sampler_pool);
+                    break;
+                case AudioGenSampler::dpmpp_2m:
+                    sampler_dpmpp_2m(dit_out_data, dit_x_in_data, prev_denoised.data(), batch_sz * dit_x_sz, i > 0 ? t_buffer[i - 1] : 0.0f, curr_t,
+                                     next_t, sampler_pool);
+                    break;
+                default:
+                    sampler_ping_pong(dit_out_data, dit_x_in_data, dit_x_sz, curr_t, next_t, i, seeds, sampler_pool);
+                    break;
+            }
+
+            // Once the estimate barely changes, stop early or extrapolate the next step. Two steps
+            // are never extrapolated in a row, so each extrapolation is checked by the next DiT call
+            if (adaptive_threshold > 0.0f && i > 0 && i + 1 < num_steps) {
+                const float change = get_relative_change(prev_denoised.data(), dit_out_data, prev_denoised.size());
+                if (change < adaptive_threshold * k_adaptive_stop_ratio) {
+                    // The final x is the current estimate, with the noise level of the last step
+                    sampler_extrapolate(prev_denoised.data(), dit_out_data, dit_x_in_data, dit_x_sz, 0.0f, t_buffer[num_steps], i, seeds,
+                                        sampler_pool);
+                    timings.dit_steps_saved += num_steps - 1 - i;
+                    if (dit_profiler != nullptr) {
+                        dit_profiler->EndEvent(step_event);
+                    }
+                    timings.dit_step.push_back((time_in_us() - start_step) / 1000.0f);
+                    observe_step(i);
+                    break;
+                }
+                extrapolate_next = change < adaptive_threshold;
+            }
+        }
+
+        if (dit_profiler != nullptr) {
+            dit_profiler->EndEvent(step_event);
+        }
+        timings.dit_step.push_back((time_in_us() - start_step) / 1000.0f);
+        observe_step(i);
+    }
+    auto end_dit = time_in_ms();
+
+    timings.dit          = (end_dit - start_dit);
+    timings.dit_avg_step = (timings.dit / static_cast<float>(timings.dit_steps_run));
+}
+
+// ----- Stage 3: autoencoder
+// Decode the latent in overlapping chunks of decode_chunk_len frames and stream the audio to the output
+// as soon as each chunk is decoded. Consecutive chunks are linearly cross-faded over their overlap, and
+// the last chunk is aligned to the end of the latent so that all the chunks have the same shape.
+// Its overlap with the previous chunk is therefore larger than decode_overlap. The latent must be longer
+// than a chunk
+static void decode_chunked(AudioGenModels& models, const AudioGenJob& job, const float* latent_data, size_t latent_len, long start_time, AudioGenTimings& timings) {
+    tflite::Interpreter* autoencoder_interpreter = models.autoencoder_interpreter.get();
+
+    float* autoencoder_in_data = autoencoder_interpreter->typed_tensor<float>(autoencoder_interpreter->inputs()[0]);
+    const float* autoencoder_out_data = autoencoder_interpreter->typed_tensor<float>(autoencoder_interpreter->outputs()[0]);
+
+    const size_t num_channels = models.latent_channels;
+    const size_t chunk_len = models.decode_chunk_len;
+    const size_t hop = chunk_len - models.decode_overlap;
+    const size_t up = models.samples_per_frame;
+    const size_t chunk_samples = chunk_len * up;
+    const size_t num_out_samples = get_num_audio_samples(models, job);
+
+    auto start_save = time_in_ms();
+
+    std::unique_ptr<AudioGenWavWriter> writer;
+    if (!job.write_audio) {
+        writer = std::make_unique<AudioGenWavWriter>(job.output_path, num_out_samples, job.output_format);
+    }
+
+    timings.save += (time_in_ms() - start_save);
+
+    // Samples of the previous chunk that overlap the current one, per channel
+    std::vector<float> tail_l;
+    std::vector<float> tail_r;
+    std::vector<float> mix_l(chunk_samples);
+    std::vector<float> mix_r(chunk_samples);
+
+    size_t num_written = 0;
+    size_t chunk_start = 0;
+    while (true) {
+        const size_t chunk_end = chunk_start + chunk_len;
+        const bool is_last = chunk_end == latent_len;
+        size_t next_start = is_last ? latent_len : chunk_start + hop;
+        if (!is_last && next_start + chunk_len + models.decode_overlap >= latent_len) {
+            // The next chunk is the last one
+            next_start = latent_len - chunk_len;
+        }
+
+        auto start_autoencoder = time_in_ms();
+
+        for (size_t c = 0; c < num_channels; ++c) {
+            memcpy(autoencoder_in_data + c * chunk_len, latent_data + c * latent_len + chunk_start, chunk_len * sizeof(float));
+        }
+
+        // Run AutoEncoder
+        AUDIOGEN_CHECK(autoencoder_interpreter->Invoke() == kTfLiteOk);
+
+        auto end_autoencoder = time_in_ms();
+
+        const float* left_ch = autoencoder_out_data;
+        const float* right_ch = autoencoder_out_data + chunk_samples;
+
+        // The samples before next_start are final: cross-fade the overlap with the previous chunk
+        const size_t num_final = (next_start - chunk_start) * up;
+        const size_t num_fade = tail_l.size();
+        for (size_t i = 0; i < num_final; ++i) {
+            if (i < num_fade) {
+                const float w = (i + 0.5f) / num_fade;
+                mix_l[i] = (1.0f - w) * tail_l[i] + w * left_ch[i];
+                mix_r[i] = (1.0f - w) * tail_r[i] + w * right_ch[i];
+            } else {
+                mix_l[i] = left_ch[i];
+                mix_r[i] = right_ch[i];
+            }
+        }
+
+        // Keep the samples that overlap the next chunk
+        tail_l.assign(left_ch + num_final, left_ch + chunk_samples);
+        tail_r.assign(right_ch + num_final, right_ch + chunk_samples);
+
+        auto start_chunk_save = time_in_ms();
+
+        // The audio beyond the requested length is dropped
+        const size_t num_write = std::min(num_final, num_out_samples - num_written);
+        if (job.write_audio) {
+            job.write_audio(mix_l.data(), mix_r.data(), num_write);
+        } else {
+            writer->write(mix_l.data(), mix_r.data(), num_write);
+            writer->flush();
+        }
+        num_written += num_write;
+
+        auto end_chunk_save = time_in_ms();
+
+        if (chunk_start == 0 && timings.first_sample == 0) {
+            timings.first_sample = end_chunk_save - start_time;
+        }
+
+        timings.autoencoder += (end_autoencoder - start_autoencoder);
+        timings.save        += (end_chunk_save - start_chunk_save);
+
+        if (is_last) {
+            break;
+        }
+        chunk_start = next_start;
+    }
+}
+
+// Decode the latent at latent_data[b * latent_channels * latent_len] and save it to the output path of each job
+void run_autoencoder(AudioGenModels& models, const std::vector<AudioGenJob>& jobs, const float* latent_data, long start_time, AudioGenTimings& timings) {
+    set_thread_affinity(models.affinity.autoencoder);
+
+    // In the low-memory mode, the autoencoder is only loaded once the diffusion is over
+    acquire_autoencoder(models, timings);
+
+    tflite::Interpreter* autoencoder_interpreter = models.autoencoder_interpreter.get();
+
+    const size_t latent_len = get_latent_len(models, jobs[0]);
+    const size_t latent_sz = models.latent_channels * latent_len;
+
+    if (models.decode_chunk_len > 0 && latent_len > models.decode_chunk_len) {
+        resize_autoencoder(models, models.decode_chunk_len);
+        acquire_arena(models, autoencoder_interpreter);
+        for (size_t b = 0; b < jobs.size(); ++b) {
+            decode_chunked(models, jobs[b], latent_data + b * latent_sz, latent_len, start_time, timings);
+        }
+        release_arena(models, autoencoder_interpreter);
+        release_autoencoder(models);
+        return;
+    }
+
+    resize_autoencoder(models, latent_len);
+    acquire_arena(models, autoencoder_interpreter);
+
+    const size_t autoencoder_in_id = autoencoder_interpreter->inputs()[0];
+    const size_t autoencoder_out_id = autoencoder_interpreter->outputs()[0];
+
+    float* autoencoder_in_data = autoencoder_interpreter->typed_tensor<float>(autoencoder_in_id);
+    float* autoencoder_out_data = autoencoder_interpreter->typed_tensor<float>(autoencoder_out_id);
+    TfLiteIntArray* autoencoder_out_dims = autoencoder_interpreter->tensor(autoencoder_out_id)->dims;
+
+    for (size_t b = 0; b < jobs.size(); ++b) {
+        auto start_autoencoder = time_in_ms();
+
+        // Initialize the autoencoder's input, unless it already is the latent (zero-copy mode)
+        const float* latent = latent_data + b * latent_sz;
+        if (autoencoder_in_data != latent) {
+            memcpy(autoencoder_in_data, latent, latent_sz * sizeof(float));
+        }
+
+        // Run AutoEncoder
+        AUDIOGEN_CHECK(autoencoder_interpreter->Invoke() == kTfLiteOk);
+
+        auto end_autoencoder = time_in_ms();
+
+        const size_t num_decoded_samples = get_num_elems(autoencoder_out_dims) / 2;
+        const float* left_ch = autoencoder_out_data;
+        const float* right_ch = autoencoder_out_data + num_decoded_samples;
+
+        // Save the file, without the audio beyond the requested length
+        auto start_save = time_in_ms();
+
+        write_job_audio(jobs[b], left_ch, right_ch, get_num_audio_samples(models, jobs[b]));
+
+        auto end_save = time_in_ms();
+
+        if (b == 0) {
+            timings.first_sample = end_save - start_time;
+        }
+
+        timings.autoencoder += (end_autoencoder - start_autoencoder);
+        timings.save        += (end_save - start_save);
+    }
+
+    release_arena(models, autoencoder_interpreter);
+    release_autoencoder(models);
+}
+
+// Run T5 and the diffusion of jobs with a DiT batch of latent_len frames, and return the final latents.
+// They are left in the DiT x input or, in the shared-arena mode, copied to latent before the DiT
+// releases its activations. In that mode, the conditioning is also kept in host buffers while T5
+// runs, since the DiT inputs are only allocated once T5 has released its own activations
+static const float* run_denoising(AudioGenModels& models, const std::vector<AudioGenJob>& jobs, size_t latent_len,
+                                  std::vector<float>& latent, AudioGenTimings& timings) {
+    const size_t batch_sz = jobs.size();
+    tflite::Interpreter* dit_interpreter = models.dit_interpreter.get();
+    const auto get_dit_input = [dit_interpreter](size_t in_idx) {
+        return dit_interpreter->typed_tensor<float>(dit_interpreter->inputs()[in_idx]);
+    };
+
+    reset_peak_rss();
+    if (models.shared_arena) {
+        std::vector<float> crossattn(batch_sz * models.dit_crossattn_sz);
+        std::vector<float> globalcond(batch_sz * models.dit_globalcond_sz);
+        run_conditioners(models, jobs, crossattn.data(), globalcond.data(), timings);
+
+        resize_dit_inputs(models, batch_sz, latent_len);
+        acquire_arena(models, dit_interpreter);
+        memcpy(get_dit_input(k_dit_crossattn_in_idx), crossattn.data(), crossattn.size() * sizeof(float));
+        memcpy(get_dit_input(k_dit_globalcond_in_idx), globalcond.data(), globalcond.size() * sizeof(float));
+    } else {
+        // Since the crossattn and global conditioner are constants, T5 writes them
+        // directly to the DiT inputs, outside the diffusion for loop
+        resize_dit_inputs(models, batch_sz, latent_len);
+        run_conditioners(models, jobs, get_dit_input(k_dit_crossattn_in_idx), get_dit_input(k_dit_globalcond_in_idx), timings);
+    }
+    timings.peak_rss.t5 = get_peak_rss_kb();
+
+    reset_peak_rss();
+    run_diffusion(models, jobs, timings);
+
+    const float* latent_data = get_dit_input(k_dit_x_in_idx);
+    if (models.shared_arena) {
+        latent.assign(latent_data, latent_data + batch_sz * models.latent_channels * latent_len);
+        release_arena(models, dit_interpreter);
+        latent_data = latent.data();
+    }
+    timings.peak_rss.dit = get_peak_rss_kb();
+
+    return latent_data;
+}
+
+// Generate one audio clip per job. The T5 and autoencoder models run once per job,
+// while all the latents are denoised together with a single DiT invocation per step.
+// All the jobs must use the same number of steps and the same audio length
+AudioGenTimings generate_audio_batch(AudioGenModels& models, const std::vector<AudioGenJob>& jobs) {
+    AUDIOGEN_CHECK(!jobs.empty());
+    for (const AudioGenJob& job : jobs) {
+        AUDIOGEN_CHECK(job.num_steps == jobs[0].num_steps);
+        AUDIOGEN_CHECK(job.adaptive_threshold == jobs[0].adaptive_threshold);
+        AUDIOGEN_CHECK(job.sampler == jobs[0].sampler);
+        AUDIOGEN_CHECK(job.logsnr_start == jobs[0].logsnr_start && job.logsnr_end == jobs[0].logsnr_end);
+        AUDIOGEN_CHECK(job.audio_len_sec == jobs[0].audio_len_sec);
+        AUDIOGEN_CHECK(job.audio_len_sec > 0.0f && job.audio_len_sec <= get_max_audio_len_sec(models));
+    }
+
+    auto start = time_in_ms();
+
+    AudioGenTimings timings;
+
+    std::vector<float> latent;
+    const float* latent_data = run_denoising(models, jobs, get_latent_len(models, jobs[0]), latent, timings);
+
+    reset_peak_rss();
+    run_autoencoder(models, jobs, latent_data, start, timings);
+    timings.peak_rss.autoencoder = get_peak_rss_kb();
+    timings.peak_rss.idle = get_rss_kb();
+
+    timings.total = timings.t5 + timings.dit + timings.autoencoder + timings.load;
+    timings.wall  = time_in_ms() - start;
+
+    return timings;
+}
+
+// ----- Long-form generation
+// Plan the segments of a clip of audio_len_sec seconds. The segments start on a latent frame
+// boundary, consecutive segments overlap by at least overlap_sec seconds, and the last one ends
+// at the end of the clip
+std::vector<AudioGenSegment> plan_segments(const AudioGenModels& models, float audio_len_sec, float overlap_sec) {
+    const size_t up = models.samples_per_frame;
+    const size_t total_samples = static_cast<size_t>(std::lround(audio_len_sec * k_audio_sample_rate));
+    const size_t segment_samples = static_cast<size_t>(std::lround(k_audio_len_sec * k_audio_sample_rate));
+    const size_t overlap_samples = static_cast<size_t>(std::lround(overlap_sec * k_audio_sample_rate));
+    AUDIOGEN_CHECK(overlap_samples + up <= segment_samples);
+
+    std::vector<AudioGenSegment> segments;
+    if (total_samples <= segment_samples) {
+        segments.push_back({0, 0, total_samples});
+        return segments;
+    }
+
+    const size_t hop_frames = (segment_samples - overlap_samples) / up;
+    const size_t last_start_frame = (total_samples - segment_samples + up - 1) / up;
+
+    for (size_t start_frame = 0; start_frame < last_start_frame; start_frame += hop_frames) {
+        segments.push_back({start_frame, start_frame * up, segment_samples});
+    }
+    segments.push_back({last_start_frame, last_start_frame * up, total_samples - last_start_frame * up});
+    return segments;
+}
+
+// Decode a latent and return its first num_samples samples
+static void decode_to_buffer(AudioGenModels& models, const float* latent, size_t latent_len, size_t num_samples,
+                             std::vector<float>& left_ch, std::vector<float>& right_ch, AudioGenTimings& timings) {
+    set_thread_affinity(models.affinity.autoencoder);
+    resize_autoencoder(models, latent_len);
+
+    tflite::Interpreter* autoencoder_interpreter = models.autoencoder_interpreter.get();
+    acquire_arena(models, autoencoder_interpreter);
+    float* autoencoder_in_data = autoencoder_interpreter->typed_tensor<float>(autoencoder_interpreter->inputs()[0]);
+    const float* autoencoder_out_data = autoencoder_interpreter->typed_tensor<float>(autoencoder_interpreter->outputs()[0]);
+
+    auto start_autoencoder = time_in_ms();
+
+    memcpy(autoencoder_in_data, latent, models.latent_channels * latent_len * sizeof(float));
+    AUDIOGEN_CHECK(autoencoder_interpreter->Invoke() == kTfLiteOk);
+
+    auto end_autoencoder = time_in_ms();
+
+    const size_t num_decoded_samples = latent_len * models.samples_per_frame;
+    AUDIOGEN_CHECK(num_samples <= num_decoded_samples);
+    left_ch.assign(autoencoder_out_data, autoencoder_out_data + num_samples);
+    right_ch.assign(autoencoder_out_data + num_decoded_samples, autoencoder_out_data + num_decoded_samples + num_samples);
+
+    timings.autoencoder += (end_autoencoder - start_autoencoder);
+}
+
+// The segments are denoised in DiT batches of up to k_max_segment_batch segments, which bounds
+// the activations of the DiT whatever the length of the clip, and share the conditioning of the
+// prompt. Their initial noise is read from a single noise sequence that spans the whole clip, so
+// that two segments start from the same noise where they overlap, and the sampler noise of the
+// segment i uses the seed + i. The decoded segments are joined with equal-power cross-fades
+AudioGenTimings generate_long_audio(AudioGenModels& models, const AudioGenJob& job) {
+    AUDIOGEN_CHECK(job.audio_len_sec > 0.0f && job.audio_len_sec <= k_max_long_audio_len_sec);
+    // The segments are batched, which the shared buffers do not support
+    AUDIOGEN_CHECK(models.shared_buffers.empty());
+
+    auto start = time_in_ms();
+
+    const std::vector<AudioGenSegment> segments = plan_segments(models, job.audio_len_sec, models.segment_overlap_sec);
+    const size_t num_channels = models.latent_channels;
+    const size_t latent_len = models.max_latent_len;
+
+    // Initial noise of the whole clip, stored as [channels, frames] like the latent
+    const size_t noise_len = segments.back().start_frame + latent_len;
+    std::vector<float> noise(num_channels * noise_len);
+    fill_random_norm_dist(noise.data(), noise.size(), job.seed, k_rng_stream_init, models.sampler_pool.get());
+
+    std::vector<AudioGenJob> segment_jobs(segments.size(), job);
+    for (size_t i = 0; i < segments.size(); ++i) {
+        AudioGenJob& segment_job = segment_jobs[i];
+        segment_job.seed = job.seed + i;
+        segment_job.audio_len_sec = k_audio_len_sec;
+        segment_job.init_noise.resize(num_channels * latent_len);
+        for (size_t c = 0; c < num_channels; ++c) {
+            memcpy(segment_job.init_noise.data() + c * latent_len, noise.data() + c * noise_len + segments[i].start_frame, latent_len * sizeof(float));
+        }
+    }
+
+    AudioGenTimings timings;
+
+    // The timings of the sub-batches are added, step by step for dit_step, so that they describe
+    // the denoising of the whole clip
+    const size_t segment_latent_sz = num_channels * latent_len;
+    std::vector<float> latents(segments.size() * segment_latent_sz);
+    std::vector<float> latent;
+    for (size_t first = 0; first < segment_jobs.size(); first += k_max_segment_batch) {
+        const size_t last = std::min(first + k_max_segment_batch, segment_jobs.size());
+        const std::vector<AudioGenJob> batch_jobs(segment_jobs.begin() + first, segment_jobs.begin() + last);
+
+        AudioGenTimings batch_timings;
+        const float* batch_latent = run_denoising(models, batch_jobs, latent_len, latent, batch_timings);
+        memcpy(latents.data() + first * segment_latent_sz, batch_latent, batch_jobs.size() * segment_latent_sz * sizeof(float));
+
+        timings.tokenizer += batch_timings.tokenizer;
+        timings.t5 += batch_timings.t5;
+        timings.dit += batch_timings.dit;
+        timings.cond_cache_hits += batch_timings.cond_cache_hits;
+        timings.dit_steps_run = std::max(timings.dit_steps_run, batch_timings.dit_steps_run);
+        timings.dit_steps_saved = first == 0 ? batch_timings.dit_steps_saved : std::min(timings.dit_steps_saved, batch_timings.dit_steps_saved);
+        timings.dit_step.resize(std::max(timings.dit_step.size(), batch_timings.dit_step.size()));
+        for (size_t i = 0; i < batch_timings.dit_step.size(); ++i) {
+            timings.dit_step[i] += batch_timings.dit_step[i];
+        }
+        timings.peak_rss.t5 = std::max(timings.peak_rss.t5, batch_timings.peak_rss.t5);
+        timings.peak_rss.dit = std::max(timings.peak_rss.dit, batch_timings.peak_rss.dit);
+    }
+    timings.dit_avg_step = timings.dit / static_cast<float>(timings.dit_steps_run);
+    const float* latent_data = latents.data();
+
+    const size_t total_samples = segments.back().start_sample + segments.back().num_samples;
+    std::vector<float> out_l(total_samples);
+    std::vector<float> out_r(total_samples);
+    std::vector<float> segment_l;
+    std::vector<float> segment_r;
+
+    constexpr float k_half_pi = 1.57079633f;
+
+    acquire_autoencoder(models, timings);
+
+    size_t mixed_end = 0;
+    for (size_t i = 0; i < segments.size(); ++i) {
+        const AudioGenSegment& segment = segments[i];
+        decode_to_buffer(models, latent_data + i * num_channels * latent_len, latent_len, segment.num_samples, segment_l, segment_r, timings);
+
+        // Equal-power cross-fade with the samples of the previous segments
+        float* dst_l = out_l.data() + segment.start_sample;
+        float* dst_r = out_r.data() + segment.start_sample;
+        const size_t num_fade = mixed_end > segment.start_sample ? mixed_end - segment.start_sample : 0;
+        for (size_t k = 0; k < segment.num_samples; ++k) {
+            if (k < num_fade) {
+                const float theta = k_half_pi * (k + 0.5f) / num_fade;
+                const float w_out = std::cos(theta);
+                const float w_in = std::sin(theta);
+                dst_l[k] = w_out * dst_l[k] + w_in * segment_l[k];
+                dst_r[k] = w_out * dst_r[k] + w_in * segment_r[k];
+            } else {
+                dst_l[k] = segment_l[k];
+                dst_r[k] = segment_r[k];
+            }
+        }
+        mixed_end = std::max(mixed_end, segment.start_sample + segment.num_samples);
+    }
+
+    release_arena(models, models.autoencoder_interpreter.get());
+    release_autoencoder(models);
+
+    auto start_save = time_in_ms();
+
+    write_job_audio(job, out_l.data(), out_r.data(), total_samples);
+
+    auto end_save = time_in_ms();
+
+    timings.save         = (end_save - start_save);
+    timings.first_sample = (end_save - start);
+    timings.total        = timings.t5 + timings.dit + timings.autoencoder + timings.load;
+    timings.wall         = time_in_ms() - start;
+    timings.peak_rss.idle = get_rss_kb();
+
+    return timings;
+}
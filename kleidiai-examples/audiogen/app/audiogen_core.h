@@ -0,0 +1,652 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Arm Limited and/or its
+ * affiliates <open-source-office@arm.com>
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIOGEN_CORE_H
+#define AUDIOGEN_CORE_H
+
+// Models and stages of the audiogen app, shared by the audiogen executable and the audiogen_bench
+// benchmark. A generation runs the tokenizer and T5, the DiT and the autoencoder one after another.
+
+// LiteRT header files
+#include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/delegates/xnnpack/xnnpack_delegate.h"
+#include "tensorflow/lite/interpreter.h"
+#include "tensorflow/lite/kernels/register.h"
+#include "tensorflow/lite/model.h"
+#include "tensorflow/lite/profiling/buffered_profiler.h"
+
+#include "audio_output.h"
+#include "sampler.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iosfwd>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace sentencepiece {
+class SentencePieceProcessor;
+}
+
+inline long time_in_ms() {
+    using namespace std::chrono;
+    auto now = time_point_cast<milliseconds>(steady_clock::now());
+    return now.time_since_epoch().count();
+}
+
+inline long time_in_us() {
+    using namespace std::chrono;
+    auto now = time_point_cast<microseconds>(steady_clock::now());
+    return now.time_since_epoch().count();
+}
+
+constexpr float k_audio_len_sec = 10.0f;
+constexpr size_t k_num_steps = 8;
+constexpr int32_t k_audio_sample_rate = 44100;
+
+// -- The latent length of the clips shorter than k_audio_len_sec is rounded up to a multiple of
+// k_latent_len_align frames, which is also the shortest latent
+constexpr size_t k_latent_len_align = 8;
+
+// -- Minimum overlap, in seconds, between two segments of a long-form clip
+constexpr float k_segment_overlap_sec = 2.0f;
+
+// -- Longest long-form clip, in seconds, and largest number of its segments denoised in one DiT batch
+constexpr float k_max_long_audio_len_sec = 600.0f;
+constexpr size_t k_max_segment_batch = 8;
+
+// -- Update the tensor index based on your model configuration.
+constexpr size_t k_t5_ids_in_idx = 0;
+constexpr size_t k_t5_attnmask_in_idx = 1;
+constexpr size_t k_t5_audio_len_in_idx = 2;
+constexpr size_t k_t5_crossattn_out_idx = 0;
+constexpr size_t k_t5_globalcond_out_idx = 2;
+
+// -- End-of-sequence token of the T5 SentencePiece model
+constexpr int32_t k_t5_eos_id = 1;
+
+constexpr size_t k_dit_crossattn_in_idx = 0;
+constexpr size_t k_dit_globalcond_in_idx = 1;
+constexpr size_t k_dit_x_in_idx = 2;
+constexpr size_t k_dit_t_in_idx = 3;
+constexpr size_t k_dit_out_idx = 0;
+
+// Raised by AUDIOGEN_CHECK with the location of the failed check. libaudiogen turns it into a
+// status code, so that a failed generation does not end the process that embeds it
+class AudioGenError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+#define AUDIOGEN_CHECK(x)                                                                           \
+    if (!(x)) {                                                                                     \
+        throw AudioGenError(std::string("Error at ") + __FILE__ + ":" + std::to_string(__LINE__)); \
+    }
+
+// Tag of the profiler events that cover one DiT step, including the sampler
+constexpr const char* k_dit_step_event_tag = "DiT step";
+
+struct TfLiteDelegateDeleter {
+    void operator()(TfLiteDelegate* delegate) const {
+        TfLiteXNNPackDelegateDelete(delegate);
+    }
+};
+
+// Number of XNNPack threads used by each stage
+struct AudioGenThreads {
+    size_t t5 = 1;
+    size_t dit = 1;
+    size_t autoencoder = 1;
+};
+
+// CPUs of each stage. The XNNPack threads of a stage, and the thread that invokes it, only run on
+// these CPUs. A stage is not pinned when all the lists are empty
+struct AudioGenAffinity {
+    std::vector<int32_t> t5;
+    std::vector<int32_t> dit;
+    std::vector<int32_t> autoencoder;
+};
+
+// CPUs of the same capacity. On big.LITTLE SoCs, each type of core forms a cluster
+struct AudioGenCpuCluster {
+    size_t capacity = 0;
+    std::vector<int32_t> cpus;
+};
+
+// Precision of a stage. With fp16, XNNPack runs the float operators in fp16. With int8, the stage
+// loads a model with dynamic-range int8 weights, whose fully connected and convolution operators
+// quantize their activations to int8 on the fly. The model of a stage is <stem>_<precision>.tflite
+// when this file exists, and the default model otherwise
+enum class AudioGenPrecision {
+    fp32,
+    fp16,
+    int8,
+};
+
+// Sampler of the diffusion. The ping-pong sampler of Stable Audio Open re-noises the denoised
+// estimate at each step. The Euler and DPM-Solver++(2M) samplers solve the probability flow ODE
+// instead and add no noise after the initial one, which suits the runs with few steps
+enum class AudioGenSampler {
+    ping_pong,
+    euler,
+    dpmpp_2m,
+};
+
+// Pages backing the weights of the models. The thp mode uses transparent huge pages, and the
+// hugetlb mode the huge pages reserved in /proc/sys/vm/nr_hugepages for the model files, with
+// transparent huge pages as a fallback and for the weights packed by XNNPack
+enum class AudioGenHugePages {
+    none,
+    thp,
+    hugetlb,
+};
+
+// The default precisions match the default models: T5 is exported in fp32, the DiT with
+// dynamic-range int8 weights, and the autoencoder in fp32 but run in fp16
+struct AudioGenPrecisions {
+    AudioGenPrecision t5 = AudioGenPrecision::fp32;
+    AudioGenPrecision dit = AudioGenPrecision::int8;
+    AudioGenPrecision autoencoder = AudioGenPrecision::fp16;
+};
+
+// Load-time configuration
+struct AudioGenConfig {
+    AudioGenThreads threads;
+    AudioGenPrecisions precisions;
+    AudioGenAffinity affinity;
+
+    // Directory of the XNNPack packed-weight cache files. The cache is disabled when empty
+    std::string weight_cache_dir;
+    // Length, in latent frames, of the chunks decoded by the autoencoder, and overlap between
+    // two consecutive chunks. The whole latent is decoded at once when the chunk length is 0
+    size_t decode_chunk_len = 0;
+    size_t decode_overlap = 8;
+
+    // Overlap, in seconds, of the segments of the clips longer than get_max_audio_len_sec().
+    // It must be shorter than half a segment
+    float segment_overlap_sec = k_segment_overlap_sec;
+
+    // Let T5 write the conditioning directly to the DiT inputs, and the autoencoder read the latent
+    // directly from the DiT x input. Only valid for sequential, unbatched and unchunked generation
+    bool zero_copy = false;
+
+    // Maximum number of T5 outputs kept in memory, and directory where they are also stored.
+    // The conditioning cache is disabled when the number of entries is 0
+    size_t cond_cache_entries = 0;
+    std::string cond_cache_dir;
+
+    // Attach a profiler to each interpreter to record the latency of every operator
+    bool profile = false;
+
+    // Only keep the DiT loaded between two generations. T5 is loaded again when a prompt misses the
+    // conditioning cache, and the autoencoder after the diffusion, and both are released once they
+    // have run. Not available in zero-copy and profiling modes
+    bool low_memory = false;
+
+    // Load the three stages on concurrent threads. The stages are always loaded one after
+    // another in the low-memory mode, to keep its peak memory low
+    bool parallel_load = true;
+
+    // Release the activations of each interpreter once its stage has run, so that the stages of a
+    // generation reuse the same memory instead of each keeping its own arena. The conditioning and
+    // the latent are kept in host buffers between the stages. When the stages have the same number
+    // of threads, CPUs and fp16 setting, and no weight cache, they also share one XNNPack delegate,
+    // whose workspace is then sized to the largest stage. Only valid for sequential generation,
+    // and not available in zero-copy mode
+    bool shared_arena = false;
+
+    // Copy each model to anonymous memory backed by huge pages instead of memory-mapping its file,
+    // and collapse the buffers where XNNPack packs the weights into huge pages, so that the DiT steps
+    // take fewer TLB misses. Not available in the low-memory mode, which drops the pages of the model files
+    AudioGenHugePages huge_pages = AudioGenHugePages::none;
+
+    // Place the model, the packed weights and the activations of each stage on the NUMA node of its
+    // CPUs. A stage whose CPUs span several nodes is left to the first-touch placement
+    bool numa_bind = false;
+};
+
+// Start-up cost of a stage, in ms
+struct AudioGenStageStartup {
+    // Start of the load, since the start of load_models()
+    long start = 0;
+    long load = 0;
+    long build = 0;
+    long delegate = 0;
+    long allocate = 0;
+    // Precision and model of the stage, and whether the model holds int8 weights
+    AudioGenPrecision precision = AudioGenPrecision::fp32;
+    std::string model_path;
+    bool int8_weights = false;
+    // Path of the XNNPack packed-weight cache file, and whether it was already on disk
+    std::string weight_cache_path;
+    bool weight_cache_hit = false;
+    // Pages of the copy of the model, bytes of packed weights collapsed into transparent huge
+    // pages, and NUMA node of the stage, or -1
+    AudioGenHugePages huge_pages = AudioGenHugePages::none;
+    size_t collapsed_bytes = 0;
+    int32_t numa_node = -1;
+};
+
+// Parameters of a stage, kept to load it again in the low-memory mode
+struct AudioGenStageParams {
+    std::string model_path;
+    AudioGenPrecision precision = AudioGenPrecision::fp32;
+    std::vector<int32_t> cpus;
+    TfLiteXNNPackDelegateOptions xnnpack_options = TfLiteXNNPackDelegateOptionsDefault();
+    std::string weight_cache_dir;
+    AudioGenHugePages huge_pages = AudioGenHugePages::none;
+    int32_t numa_node = -1;
+};
+
+struct AudioGenStartup {
+    AudioGenStageStartup t5;
+    AudioGenStageStartup dit;
+    AudioGenStageStartup autoencoder;
+    // time_in_ms() at the start of load_models(), time spent requesting the read-ahead of the
+    // model files, time spent loading the tokenizer, and duration of load_models()
+    long start_time = 0;
+    long prefetch = 0;
+    long tokenizer = 0;
+    long total = 0;
+    bool parallel = false;
+    // Shared-arena mode, and whether its stages share one XNNPack delegate
+    bool shared_arena = false;
+    bool shared_delegate = false;
+    // Huge-page mode, and anonymous memory of the process backed by transparent and by
+    // hugetlb huge pages once the models are loaded, in kB
+    AudioGenHugePages huge_pages = AudioGenHugePages::none;
+    size_t thp_kb = 0;
+    size_t hugetlb_kb = 0;
+};
+
+// Buffers allocated with posix_memalign
+struct AlignedFreeDeleter {
+    void operator()(void* ptr) const {
+        free(ptr);
+    }
+};
+
+using AlignedBuffer = std::unique_ptr<void, AlignedFreeDeleter>;
+
+// Memory allocated with mmap
+struct MappedMemoryDeleter {
+    size_t bytes = 0;
+    void operator()(void* ptr) const;
+};
+
+using MappedMemory = std::unique_ptr<void, MappedMemoryDeleter>;
+
+// A buffer backing both an output (or input) tensor of one stage and an input tensor of the next one
+struct AudioGenSharedBuffer {
+    std::string name;
+    std::string producer;
+    std::string consumer;
+    size_t bytes = 0;
+    AlignedBuffer data;
+};
+
+// Counters of the conditioning cache. A memory hit skips the tokenizer and T5 when the prompt
+// was already seen, and T5 only when another prompt gave the same token IDs. A disk hit skips T5
+struct AudioGenCondCacheStats {
+    size_t hits = 0;
+    size_t disk_hits = 0;
+    size_t misses = 0;
+    size_t entries = 0;
+    size_t bytes = 0;
+};
+
+// LRU cache of the T5 outputs. The entries are keyed on the token IDs and the audio length, the
+// only T5 inputs that vary, and a prompt index maps the prompts already seen to their entry.
+// When a directory is given, the entries are also stored on disk and reloaded on a memory miss
+class AudioGenCondCache {
+public:
+    void configure(size_t max_entries, const std::string& disk_dir, size_t crossattn_sz, size_t globalcond_sz);
+
+    bool enabled() const {
+        return max_entries_ > 0;
+    }
+
+    // Copy the conditioning of a prompt already seen to crossattn and globalcond
+    bool find_prompt(const std::string& prompt, float audio_len_sec, float* crossattn, float* globalcond);
+
+    // Copy the conditioning of the token IDs to crossattn and globalcond, from memory or from disk.
+    // On success, the prompt is added to the prompt index
+    bool find_ids(const std::string& prompt, const std::vector<int32_t>& ids, float audio_len_sec, float* crossattn, float* globalcond);
+
+    void insert(const std::string& prompt, const std::vector<int32_t>& ids, float audio_len_sec, const float* crossattn, const float* globalcond);
+
+    AudioGenCondCacheStats stats() const;
+
+private:
+    struct Entry {
+        std::string key;
+        std::vector<std::string> prompt_keys;
+        std::vector<float> crossattn;
+        std::vector<float> globalcond;
+    };
+    using EntryIt = std::list<Entry>::iterator;
+
+    static std::string make_key(const std::vector<int32_t>& ids, float audio_len_sec);
+    static std::string make_prompt_key(const std::string& prompt, float audio_len_sec);
+    static size_t entry_bytes(const Entry& entry);
+    void use_entry(EntryIt it, float* crossattn, float* globalcond);
+    void add_prompt(EntryIt it, const std::string& prompt_key);
+
+    // Insert an entry as the most recently used one and evict the least recently used ones
+    EntryIt add_entry(Entry&& entry);
+
+    // The entries are stored in <disk_dir>/<hash of the key>.t5cond as the key size, the key,
+    // the sizes of the two tensors and their content
+    std::string disk_path(const std::string& key) const;
+    bool load_entry(const std::string& key, Entry& entry) const;
+
+    // Write to a temporary file first so that a reader never sees a partial entry
+    void store_entry(const Entry& entry) const;
+
+    mutable std::mutex mutex_;
+    size_t max_entries_ = 0;
+    std::string disk_dir_;
+    size_t crossattn_sz_ = 0;
+    size_t globalcond_sz_ = 0;
+
+    // Most recently used entry first
+    std::list<Entry> lru_;
+    std::unordered_map<std::string, EntryIt> entries_;
+    std::unordered_map<std::string, EntryIt> prompts_;
+    AudioGenCondCacheStats stats_;
+};
+
+// SentencePiece tokenizer of T5, loaded once with the models. The token IDs of a prompt end with
+// the end-of-sequence token and hold at most the sequence length of T5, so that they are also the
+// key of the conditioning cache
+class AudioGenTokenizer {
+public:
+    AudioGenTokenizer();
+    ~AudioGenTokenizer();
+
+    void load(const std::string& spiece_model_path, size_t seq_len);
+
+    size_t seq_len() const {
+        return seq_len_;
+    }
+
+    // Encode the prompts in a single pass, one Encode call each, to ids[i] for prompts[i]
+    void encode_batch(const std::vector<const std::string*>& prompts, std::vector<std::vector<int32_t>>& ids) const;
+
+    // Write ids and their attention mask to the T5 inputs of seq_len() elements, padded with zeros
+    void write_t5_inputs(const std::vector<int32_t>& ids, int64_t* ids_out, int64_t* attnmask_out) const;
+
+private:
+    std::unique_ptr<sentencepiece::SentencePieceProcessor> processor_;
+    size_t seq_len_ = 0;
+};
+
+
+// Everything that is expensive to create and can be reused across generations.
+// The members are declared in dependency order so that the interpreters are
+// destroyed before the delegates and the models they reference.
+struct AudioGenModels {
+    std::string sentence_model_path;
+    AudioGenTokenizer tokenizer;
+
+    tflite::ops::builtin::BuiltinOpResolver resolver;
+
+    // Copies of the models in huge pages, which the models reference, see AudioGenConfig::huge_pages
+    MappedMemory t5_model_memory;
+    MappedMemory dit_model_memory;
+    MappedMemory autoencoder_model_memory;
+
+    std::unique_ptr<tflite::FlatBufferModel> t5_model;
+    std::unique_ptr<tflite::FlatBufferModel> dit_model;
+    std::unique_ptr<tflite::FlatBufferModel> autoencoder_model;
+
+    // Tensor buffers shared between two stages, see share_tensor_buffer()
+    std::vector<AudioGenSharedBuffer> shared_buffers;
+
+    // Per-operator profilers, only created in profiling mode. They are attached to the interpreters
+    // before the delegates, so that the XNNPack delegate also reports its own operators
+    std::unique_ptr<tflite::profiling::BufferedProfiler> t5_profiler;
+    std::unique_ptr<tflite::profiling::BufferedProfiler> dit_profiler;
+    std::unique_ptr<tflite::profiling::BufferedProfiler> autoencoder_profiler;
+
+    // Parameters of each stage, and whether T5 and the autoencoder are only loaded when they run
+    AudioGenStageParams t5_params;
+    AudioGenStageParams dit_params;
+    AudioGenStageParams autoencoder_params;
+    bool low_memory = false;
+    bool shared_arena = false;
+
+    // One delegate, and therefore one thread pool, per stage, unless the shared-arena mode
+    // applies the shared delegate to the three stages
+    std::unique_ptr<TfLiteDelegate, TfLiteDelegateDeleter> xnnpack_delegate_shared;
+    std::unique_ptr<TfLiteDelegate, TfLiteDelegateDeleter> xnnpack_delegate_t5;
+    std::unique_ptr<TfLiteDelegate, TfLiteDelegateDeleter> xnnpack_delegate_dit;
+    std::unique_ptr<TfLiteDelegate, TfLiteDelegateDeleter> xnnpack_delegate_autoencoder;
+
+    std::unique_ptr<tflite::Interpreter> t5_interpreter;
+    std::unique_ptr<tflite::Interpreter> dit_interpreter;
+    std::unique_ptr<tflite::Interpreter> autoencoder_interpreter;
+
+    // Number of elements of a single batch item of the DiT conditioning inputs
+    size_t dit_crossattn_sz = 0;
+    size_t dit_globalcond_sz = 0;
+
+    // Latent shape the models were exported with (channels x frames), and number of audio
+    // samples per latent frame
+    size_t latent_channels = 0;
+    size_t max_latent_len = 0;
+    size_t samples_per_frame = 0;
+
+    // Chunked decoding, see AudioGenConfig
+    size_t decode_chunk_len = 0;
+    size_t decode_overlap = 0;
+
+    // Long-form generation, see AudioGenConfig
+    float segment_overlap_sec = k_segment_overlap_sec;
+
+    // Current batch size and latent length of the DiT inputs, and latent length of the
+    // autoencoder input
+    size_t dit_batch_sz = 1;
+    size_t dit_latent_len = 0;
+    size_t autoencoder_latent_len = 0;
+
+    // Threads of the noise generation and sampler update, between two DiT steps. There are as many
+    // as DiT threads, pinned to the CPUs of the DiT
+    std::unique_ptr<AudioGenThreadPool> sampler_pool;
+
+    // CPUs of each stage. When a stage is pinned, the stages without CPUs run on all the online CPUs
+    AudioGenAffinity affinity;
+
+    // Memoized T5 outputs, disabled unless AudioGenConfig::cond_cache_entries is set
+    AudioGenCondCache cond_cache;
+
+    AudioGenStartup startup;
+};
+
+// Receives the intermediate tensors of a job at the stage boundaries, for example to compare them
+// with reference outputs. The data is only valid during the call, and the time of the calls is
+// counted in the latency of the stages
+struct AudioGenJobObserver {
+    // T5 outputs, or the conditioning taken from the conditioning cache
+    std::function<void(const float* crossattn, size_t crossattn_sz, const float* globalcond, size_t globalcond_sz)> on_conditioning;
+    // Latent x after each step, including the extrapolated ones
+    std::function<void(size_t step, const float* x, size_t x_sz)> on_dit_step;
+};
+
+// A single generation request
+struct AudioGenJob {
+    std::string prompt;
+    size_t seed = 0;
+    size_t num_steps = k_num_steps;
+    std::string output_path = "output.wav";
+
+    // Sample format of the WAV file. An output path of "-" streams the file to the standard output
+    AudioGenSampleFormat output_format = AudioGenSampleFormat::f32;
+
+    // Receives the audio of the job in order, in several calls when it is streamed. The audio is
+    // saved as a WAV file to output_path when it is not set
+    std::function<void(const float* left_ch, const float* right_ch, size_t num_samples)> write_audio;
+
+    // Length of the audio, in seconds, up to get_max_audio_len_sec(). The clips shorter than
+    // k_audio_len_sec use a shorter latent, so their DiT and autoencoder cost is proportional
+    float audio_len_sec = k_audio_len_sec;
+
+    // Initial latent noise. It is generated from the seed when empty
+    std::vector<float> init_noise;
+
+    // Adaptive DiT schedule, disabled when 0. When the relative change between two consecutive
+    // denoised estimates is below the threshold, the next step extrapolates them instead of
+    // running the DiT. Below k_adaptive_stop_ratio times the threshold, the diffusion stops
+    float adaptive_threshold = 0.0f;
+
+    // Sampler, and logSNR range of the sigma schedule. The logSNR is spaced linearly from
+    // logsnr_start to logsnr_end over the steps, and the first and last sigmas are forced to
+    // k_sigma_max and k_sigma_min
+    AudioGenSampler sampler = AudioGenSampler::ping_pong;
+    float logsnr_start = k_logsnr_max;
+    float logsnr_end = k_logsnr_end;
+
+    AudioGenJobObserver observer;
+};
+
+// Peak resident set size of the process during each stage, and resident set size once the
+// generation is over, in kB. It is 0 when the peak cannot be read, and only reset between two
+// stages on Linux
+struct AudioGenPeakRss {
+    size_t t5 = 0;
+    size_t dit = 0;
+    size_t autoencoder = 0;
+    size_t idle = 0;
+};
+
+// -- Fraction of the adaptive threshold below which the diffusion stops early
+constexpr float k_adaptive_stop_ratio = 0.25f;
+
+// Per-stage latency of a single generation, in ms. For a batch of jobs,
+// each stage reports the accumulated time of all the jobs
+struct AudioGenTimings {
+    long tokenizer = 0;
+    long t5 = 0;
+    long dit = 0;
+    float dit_avg_step = 0.0f;
+    long autoencoder = 0;
+    long save = 0;
+    long total = 0;
+    // Number of DiT calls, and of steps extrapolated or skipped by the adaptive schedule
+    size_t dit_steps_run = 0;
+    size_t dit_steps_saved = 0;
+    // Duration of each step, including the DiT call and the sampler, in ms
+    std::vector<float> dit_step;
+    // Time from the submission of the job to the first audio sample written to the output
+    long first_sample = 0;
+    // Time from the submission of the job to the saved output, including any queuing
+    long wall = 0;
+    // Number of jobs whose conditioning came from the conditioning cache
+    size_t cond_cache_hits = 0;
+    // Time spent loading T5 and the autoencoder in the low-memory mode
+    long load = 0;
+    AudioGenPeakRss peak_rss;
+};
+
+// ----- Loading
+// ----------------------------------
+void load_models(AudioGenModels& models, const std::string& models_base_path, const AudioGenConfig& config);
+
+void print_startup_report(FILE* out, const AudioGenStartup& startup);
+
+const char* get_precision_name(AudioGenPrecision precision);
+
+// Parse "fp32", "fp16" or "int8"
+bool parse_precision(const std::string& name, AudioGenPrecision& precision);
+
+const char* get_huge_pages_name(AudioGenHugePages huge_pages);
+bool parse_huge_pages(const std::string& name, AudioGenHugePages& huge_pages);
+
+const char* get_sampler_name(AudioGenSampler sampler);
+
+// Parse "ping-pong", "euler" or "dpmpp-2m"
+bool parse_sampler(const std::string& name, AudioGenSampler& sampler);
+void print_shared_buffers(FILE* out, const std::vector<AudioGenSharedBuffer>& shared_buffers);
+void print_cond_cache_stats(FILE* out, const AudioGenCondCacheStats& stats);
+
+// ----- CPU affinity
+// ----------------------------------
+// Clusters of the online CPUs, from the slowest to the fastest. The capacity of a CPU is read from
+// sysfs (cpu_capacity, or cpufreq/cpuinfo_max_freq), and all the CPUs form one cluster without it
+std::vector<AudioGenCpuCluster> get_cpu_clusters();
+
+// Affinity of a placement policy:
+//   none:   no pinning
+//   little: every stage on the slowest cluster
+//   big:    every stage on all the clusters but the slowest one
+//   prime:  every stage on the fastest cluster
+// The big and prime policies use all the CPUs on a single-cluster system
+bool get_policy_affinity(const std::string& policy, const std::vector<AudioGenCpuCluster>& clusters, AudioGenAffinity& affinity);
+
+// Parse and format CPU lists like "0-3,6"
+bool parse_cpu_list(const std::string& s, std::vector<int32_t>& cpus);
+std::string format_cpu_list(const std::vector<int32_t>& cpus);
+
+void print_affinity(FILE* out, const std::vector<AudioGenCpuCluster>& clusters, const AudioGenAffinity& affinity);
+
+// ----- Generation
+// ----------------------------------
+float get_max_audio_len_sec(const AudioGenModels& models);
+
+// Number of latent frames and of audio samples of a job
+size_t get_latent_len(const AudioGenModels& models, const AudioGenJob& job);
+size_t get_num_audio_samples(const AudioGenModels& models, const AudioGenJob& job);
+
+// The stages can run on their own, for example on different threads, or one after another
+// with generate_audio_batch(). All the jobs of a batch must have the same number of steps
+// and the same audio length
+void resize_dit_inputs(AudioGenModels& models, size_t batch_sz, size_t latent_len);
+void run_conditioners(AudioGenModels& models, const std::vector<AudioGenJob>& jobs, float* crossattn_data, float* globalcond_data, AudioGenTimings& timings);
+void run_diffusion(AudioGenModels& models, const std::vector<AudioGenJob>& jobs, AudioGenTimings& timings);
+void run_autoencoder(AudioGenModels& models, const std::vector<AudioGenJob>& jobs, const float* latent_data, long start_time, AudioGenTimings& timings);
+
+AudioGenTimings generate_audio_batch(AudioGenModels& models, const std::vector<AudioGenJob>& jobs);
+
+// Header of a WAV file holding buffer_sz stereo frames of format, which follow it interleaved
+// (L0, R0, L1, R1, ...)
+void write_wav_header(std::ostream& out_file, size_t buffer_sz, AudioGenSampleFormat format = AudioGenSampleFormat::f32);
+
+// ----- Long-form generation
+// ----------------------------------
+// A clip longer than get_max_audio_len_sec() is generated as segments of k_audio_len_sec seconds,
+// which overlap by at least segment_overlap_sec seconds, and are denoised in DiT batches of up to
+// k_max_segment_batch segments. The clip is at most k_max_long_audio_len_sec seconds
+struct AudioGenSegment {
+    size_t start_frame = 0;
+    size_t start_sample = 0;
+    size_t num_samples = 0;
+};
+
+std::vector<AudioGenSegment> plan_segments(const AudioGenModels& models, float audio_len_sec, float overlap_sec);
+
+AudioGenTimings generate_long_audio(AudioGenModels& models, const AudioGenJob& job);
+
+#endif // AUDIOGEN_CORE_H
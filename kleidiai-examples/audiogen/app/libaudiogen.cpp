@@ -0,0 +1,915 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Arm Limited and/or its
+ * affiliates <open-source-office@arm.com>
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libaudiogen.h"
+
+#include "audiogen_core.h"
+
+// LiteRT header files
+#include "tensorflow/lite/builtin_ops.h"
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+static thread_local std::string g_last_error;
+
+static audiogen_status set_last_error(audiogen_status status, const std::string& error) {
+    g_last_error = error;
+    return status;
+}
+
+// ----- Submissions
+// ----------------------------------
+// Destination of the audio of a clip. Without a buffer of the caller, the interleaved frames of
+// each write are staged in frames before they are handed to the callback
+struct AudioGenClipOutput {
+    void* buffer = nullptr;
+    size_t capacity = 0;
+    AudioGenSampleFormat format = AudioGenSampleFormat::f32;
+    audiogen_audio_callback on_audio = nullptr;
+    void* user_data = nullptr;
+    size_t num_written = 0;
+    AudioGenDither dither;
+    std::vector<uint8_t> frames;
+};
+
+// Number of submissions that are not completed yet
+class AudioGenPending {
+public:
+    void add() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++count_;
+    }
+
+    void remove() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --count_;
+        idle_.notify_all();
+    }
+
+    void wait_idle() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_.wait(lock, [this]() { return count_ == 0; });
+    }
+
+private:
+    size_t count_ = 0;
+    std::mutex mutex_;
+    std::condition_variable idle_;
+};
+
+// The clips of one audiogen_generate() call, with their state while they flow through the
+// stages. The submission is shared by the context and by the handle of the caller
+struct AudioGenSubmission {
+    std::vector<AudioGenJob> jobs;
+    std::vector<AudioGenClipOutput> outputs;
+    bool long_form = false;
+    size_t num_frames = 0;
+    size_t num_segments = 0;
+
+    // Intermediate tensors of the pipeline mode
+    std::vector<float> crossattn;
+    std::vector<float> globalcond;
+    std::vector<float> latent;
+
+    AudioGenTimings timings;
+    long submit_time = 0;
+
+    audiogen_status status = AUDIOGEN_OK;
+    std::string error;
+    audiogen_result result{};
+
+    audiogen_done_callback on_done = nullptr;
+    void* user_data = nullptr;
+    AudioGenPending* pending = nullptr;
+
+    std::mutex mutex;
+    std::condition_variable done_cv;
+    bool done = false;
+};
+
+struct audiogen_handle {
+    std::shared_ptr<AudioGenSubmission> submission;
+};
+
+static void write_frames(AudioGenClipOutput& output, const float* left_ch, const float* right_ch, size_t num_frames) {
+    const size_t frame_sz = get_bytes_per_frame(output.format);
+    void* frames = nullptr;
+    if (output.buffer != nullptr) {
+        AUDIOGEN_CHECK(output.num_written + num_frames <= output.capacity);
+        frames = static_cast<uint8_t*>(output.buffer) + output.num_written * frame_sz;
+    } else {
+        output.frames.resize(num_frames * frame_sz);
+        frames = output.frames.data();
+    }
+
+    convert_frames(left_ch, right_ch, num_frames, output.format, output.dither, frames);
+
+    if (output.on_audio != nullptr) {
+        output.on_audio(output.user_data, frames, output.num_written, num_frames);
+    }
+    output.num_written += num_frames;
+}
+
+// Run fn unless an earlier stage failed, and record its failure
+template <typename Fn>
+static void run_stage(AudioGenSubmission& submission, Fn fn) {
+    if (submission.status != AUDIOGEN_OK) {
+        return;
+    }
+    try {
+        fn();
+    } catch (const std::exception& e) {
+        submission.status = AUDIOGEN_ERROR_GENERATION;
+        submission.error = e.what();
+    }
+}
+
+static void complete_submission(AudioGenSubmission& submission) {
+    AudioGenTimings& timings = submission.timings;
+    timings.wall = time_in_ms() - submission.submit_time;
+
+    audiogen_result& result = submission.result;
+    result.status = submission.status;
+    result.error = submission.error.c_str();
+    result.num_frames = submission.num_frames;
+    result.num_segments = submission.num_segments;
+    result.timings.tokenizer_ms = timings.tokenizer;
+    result.timings.t5_ms = timings.t5;
+    result.timings.dit_ms = timings.dit;
+    result.timings.dit_avg_step_ms = timings.dit_avg_step;
+    result.timings.autoencoder_ms = timings.autoencoder;
+    result.timings.output_ms = timings.save;
+    result.timings.total_ms = timings.total;
+    result.timings.first_sample_ms = timings.first_sample;
+    result.timings.wall_ms = timings.wall;
+    result.timings.load_ms = timings.load;
+    result.timings.dit_step_ms = timings.dit_step.data();
+    result.timings.num_dit_steps = timings.dit_step.size();
+    result.timings.dit_steps_run = timings.dit_steps_run;
+    result.timings.dit_steps_saved = timings.dit_steps_saved;
+    result.timings.cond_cache_hits = timings.cond_cache_hits;
+    result.timings.peak_rss_t5_kb = timings.peak_rss.t5;
+    result.timings.peak_rss_dit_kb = timings.peak_rss.dit;
+    result.timings.peak_rss_autoencoder_kb = timings.peak_rss.autoencoder;
+    result.timings.idle_rss_kb = timings.peak_rss.idle;
+
+    if (submission.on_done != nullptr) {
+        submission.on_done(submission.user_data, &result);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(submission.mutex);
+        submission.done = true;
+    }
+    submission.done_cv.notify_all();
+    submission.pending->remove();
+}
+
+// ----- Execution
+// ----------------------------------
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity) {}
+
+    // Block while the queue is full. Return false if the queue has been closed
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this]() { return closed_ || items_.size() < capacity_; });
+        if (closed_) {
+            return false;
+        }
+        items_.push_back(std::move(item));
+        not_empty_.notify_one();
+        return true;
+    }
+
+    // Block while the queue is empty. Return false once the queue is closed and drained
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this]() { return closed_ || !items_.empty(); });
+        if (items_.empty()) {
+            return false;
+        }
+        item = std::move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+private:
+    const size_t capacity_;
+    std::deque<T> items_;
+    bool closed_ = false;
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+};
+
+using AudioGenSubmissionPtr = std::shared_ptr<AudioGenSubmission>;
+
+// The submissions run one after another on a single thread
+class AudioGenWorker {
+public:
+    AudioGenWorker(AudioGenModels& models, size_t queue_depth) : models_(models), queue_(queue_depth) {
+        thread_ = std::thread(&AudioGenWorker::run, this);
+    }
+
+    ~AudioGenWorker() {
+        queue_.close();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    // Block while the queue is full
+    void submit(AudioGenSubmissionPtr submission) {
+        queue_.push(std::move(submission));
+    }
+
+private:
+    void run() {
+        AudioGenSubmissionPtr submission;
+        while (queue_.pop(submission)) {
+            // The timings of the core start with the generation, so the time spent in the queue is added
+            const long queued = time_in_ms() - submission->submit_time;
+            run_stage(*submission, [&]() {
+                submission->timings = submission->long_form ? generate_long_audio(models_, submission->jobs[0])
+                                                            : generate_audio_batch(models_, submission->jobs);
+                submission->timings.first_sample += queued;
+            });
+            complete_submission(*submission);
+            submission.reset();
+        }
+    }
+
+    AudioGenModels& models_;
+    BoundedQueue<AudioGenSubmissionPtr> queue_;
+    std::thread thread_;
+};
+
+// The three stages run on their own thread, connected by bounded queues. While the DiT
+// denoises the submission N, T5 conditions the submission N + 1 and the autoencoder decodes
+// the submission N - 1. A failed stage passes the submission on, and the following stages skip it
+class AudioGenPipeline {
+public:
+    AudioGenPipeline(AudioGenModels& models, size_t queue_depth)
+        : models_(models), t5_queue_(queue_depth), dit_queue_(queue_depth), autoencoder_queue_(queue_depth) {
+        t5_thread_ = std::thread(&AudioGenPipeline::t5_stage, this);
+        dit_thread_ = std::thread(&AudioGenPipeline::dit_stage, this);
+        autoencoder_thread_ = std::thread(&AudioGenPipeline::autoencoder_stage, this);
+    }
+
+    ~AudioGenPipeline() {
+        t5_queue_.close();
+        for (std::thread* thread : {&t5_thread_, &dit_thread_, &autoencoder_thread_}) {
+            if (thread->joinable()) {
+                thread->join();
+            }
+        }
+    }
+
+    // Block while the first stage queue is full
+    void submit(AudioGenSubmissionPtr submission) {
+        t5_queue_.push(std::move(submission));
+    }
+
+private:
+    void t5_stage() {
+        AudioGenSubmissionPtr submission;
+        while (t5_queue_.pop(submission)) {
+            run_stage(*submission, [&]() {
+                const size_t batch_sz = submission->jobs.size();
+                submission->crossattn.resize(batch_sz * models_.dit_crossattn_sz);
+                submission->globalcond.resize(batch_sz * models_.dit_globalcond_sz);
+                run_conditioners(models_, submission->jobs, submission->crossattn.data(), submission->globalcond.data(), submission->timings);
+            });
+            dit_queue_.push(std::move(submission));
+        }
+        dit_queue_.close();
+    }
+
+    void dit_stage() {
+        AudioGenSubmissionPtr submission;
+        while (dit_queue_.pop(submission)) {
+            run_stage(*submission, [&]() {
+                const size_t latent_len = get_latent_len(models_, submission->jobs[0]);
+                resize_dit_inputs(models_, submission->jobs.size(), latent_len);
+
+                tflite::Interpreter* dit_interpreter = models_.dit_interpreter.get();
+                float* dit_x_in_data = dit_interpreter->typed_tensor<float>(dit_interpreter->inputs()[k_dit_x_in_idx]);
+                float* dit_crossattn_in_data = dit_interpreter->typed_tensor<float>(dit_interpreter->inputs()[k_dit_crossattn_in_idx]);
+                float* dit_globalcond_in_data = dit_interpreter->typed_tensor<float>(dit_interpreter->inputs()[k_dit_globalcond_in_idx]);
+
+                memcpy(dit_crossattn_in_data, submission->crossattn.data(), submission->crossattn.size() * sizeof(float));
+                memcpy(dit_globalcond_in_data, submission->globalcond.data(), submission->globalcond.size() * sizeof(float));
+
+                run_diffusion(models_, submission->jobs, submission->timings);
+
+                submission->latent.assign(dit_x_in_data, dit_x_in_data + submission->jobs.size() * models_.latent_channels * latent_len);
+            });
+            autoencoder_queue_.push(std::move(submission));
+        }
+        autoencoder_queue_.close();
+    }
+
+    void autoencoder_stage() {
+        AudioGenSubmissionPtr submission;
+        while (autoencoder_queue_.pop(submission)) {
+            run_stage(*submission, [&]() {
+                run_autoencoder(models_, submission->jobs, submission->latent.data(), submission->submit_time, submission->timings);
+
+                AudioGenTimings& timings = submission->timings;
+                timings.total = timings.t5 + timings.dit + timings.autoencoder;
+            });
+            complete_submission(*submission);
+            submission.reset();
+        }
+    }
+
+    AudioGenModels& models_;
+    BoundedQueue<AudioGenSubmissionPtr> t5_queue_;
+    BoundedQueue<AudioGenSubmissionPtr> dit_queue_;
+    BoundedQueue<AudioGenSubmissionPtr> autoencoder_queue_;
+    std::thread t5_thread_;
+    std::thread dit_thread_;
+    std::thread autoencoder_thread_;
+};
+
+// The models are declared first, so that the threads of the worker or of the pipeline are
+// joined before the models are released
+struct audiogen_context {
+    AudioGenModels models;
+    std::vector<AudioGenCpuCluster> clusters;
+    AudioGenPending pending;
+    std::unique_ptr<AudioGenWorker> worker;
+    std::unique_ptr<AudioGenPipeline> pipeline;
+};
+
+// ----- Profiling
+// ----------------------------------
+// The profilers record the Invoke of each interpreter, its operators and delegate partitions, the
+// operators run by the XNNPack delegate inside each partition, and each DiT step. The events are
+// exported as a Chrome trace, readable with chrome://tracing or https://ui.perfetto.dev, with one
+// track per stage, and summarized as the list of the operators with the highest total latency.
+
+struct AudioGenProfiledStage {
+    const char* name;
+    tflite::Interpreter* interpreter;
+    tflite::profiling::BufferedProfiler* profiler;
+};
+
+static std::vector<AudioGenProfiledStage> get_profiled_stages(const AudioGenModels& models) {
+    std::vector<AudioGenProfiledStage> stages;
+    if (models.dit_profiler != nullptr) {
+        stages.push_back({"T5", models.t5_interpreter.get(), models.t5_profiler.get()});
+        stages.push_back({"DiT", models.dit_interpreter.get(), models.dit_profiler.get()});
+        stages.push_back({"Autoencoder", models.autoencoder_interpreter.get(), models.autoencoder_profiler.get()});
+    }
+    return stages;
+}
+
+// Category of a profiler event: an operator run by the interpreter ("op"), a node of the interpreter
+// delegated to XNNPack ("partition"), an operator run by XNNPack inside a partition ("delegate_op"),
+// or any other event, like the Invoke of the interpreter or a DiT step ("other")
+static const char* get_event_kind(const tflite::Interpreter* interpreter, const tflite::profiling::ProfileEvent& event) {
+    using EventType = tflite::Profiler::EventType;
+
+    if (event.event_type == EventType::DELEGATE_OPERATOR_INVOKE_EVENT) {
+        return "delegate_op";
+    }
+    if (event.event_type != EventType::OPERATOR_INVOKE_EVENT) {
+        return "other";
+    }
+
+    const bool is_primary_node = event.extra_event_metadata == 0 && event.event_metadata >= 0 &&
+                                 static_cast<size_t>(event.event_metadata) < interpreter->nodes_size();
+    if (is_primary_node) {
+        const auto* node_and_reg = interpreter->node_and_registration(static_cast<int32_t>(event.event_metadata));
+        if (node_and_reg != nullptr && node_and_reg->second.builtin_code == kTfLiteBuiltinDelegate) {
+            return "partition";
+        }
+    }
+    return "op";
+}
+
+static std::string get_event_name(const tflite::profiling::ProfileEvent& event) {
+    if (event.tag == k_dit_step_event_tag) {
+        return event.tag + " " + std::to_string(event.event_metadata);
+    }
+    return event.tag;
+}
+
+static std::string json_escape(const std::string& s) {
+    std::string out;
+    for (char c : s) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            case '\r': out += "\\r"; break;
+            default: out.push_back(c); break;
+        }
+    }
+    return out;
+}
+
+static bool write_chrome_trace(const std::string& path, const AudioGenModels& models) {
+    std::ofstream out_file(path);
+    if (!out_file.is_open()) {
+        return false;
+    }
+
+    out_file << "{\"traceEvents\": [\n";
+
+    const std::vector<AudioGenProfiledStage> stages = get_profiled_stages(models);
+    bool is_first = true;
+    for (size_t tid = 0; tid < stages.size(); ++tid) {
+        const AudioGenProfiledStage& stage = stages[tid];
+
+        out_file << (is_first ? "" : ",\n")
+                 << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": " << tid
+                 << ", \"args\": {\"name\": \"" << stage.name << "\"}}";
+        is_first = false;
+
+        for (const tflite::profiling::ProfileEvent* event : stage.profiler->GetProfileEvents()) {
+            out_file << ",\n{\"name\": \"" << json_escape(get_event_name(*event))
+                     << "\", \"cat\": \"" << get_event_kind(stage.interpreter, *event)
+                     << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << tid
+                     << ", \"ts\": " << event->begin_timestamp_us
+                     << ", \"dur\": " << event->elapsed_time
+                     << ", \"args\": {\"node\": " << event->event_metadata
+                     << ", \"subgraph\": " << event->extra_event_metadata << "}}";
+        }
+    }
+
+    out_file << "\n]}\n";
+    return out_file.good();
+}
+
+// Print the top_n operators and partitions with the highest total latency. The share of each
+// one is relative to the total latency of the interpreter nodes of its stage, so the operators
+// run inside a partition are also a share of that partition
+static void print_hot_ops(FILE* out, const AudioGenModels& models, size_t top_n) {
+    struct HotOp {
+        const char* stage;
+        const char* kind;
+        std::string name;
+        size_t count = 0;
+        uint64_t total_us = 0;
+    };
+
+    std::vector<HotOp> hot_ops;
+    std::unordered_map<std::string, uint64_t> stage_total_us;
+
+    for (const AudioGenProfiledStage& stage : get_profiled_stages(models)) {
+        std::unordered_map<std::string, size_t> op_idx;
+
+        for (const tflite::profiling::ProfileEvent* event : stage.profiler->GetProfileEvents()) {
+            const char* kind = get_event_kind(stage.interpreter, *event);
+            if (strcmp(kind, "other") == 0) {
+                continue;
+            }
+            if (strcmp(kind, "delegate_op") != 0) {
+                stage_total_us[stage.name] += event->elapsed_time;
+            }
+
+            const std::string key = std::string(kind) + "/" + event->tag;
+            auto it = op_idx.find(key);
+            if (it == op_idx.end()) {
+                it = op_idx.emplace(key, hot_ops.size()).first;
+                hot_ops.push_back({stage.name, kind, event->tag});
+            }
+            hot_ops[it->second].count += 1;
+            hot_ops[it->second].total_us += event->elapsed_time;
+        }
+    }
+
+    std::sort(hot_ops.begin(), hot_ops.end(), [](const HotOp& a, const HotOp& b) { return a.total_us > b.total_us; });
+
+    fprintf(out, "Top %zu operators by total latency:\n", std::min(top_n, hot_ops.size()));
+    fprintf(out, "  %-12s %-12s %8s %12s %12s %7s  %s\n", "Stage", "Kind", "Count", "Total (ms)", "Avg (us)", "Share", "Name");
+    for (size_t i = 0; i < std::min(top_n, hot_ops.size()); ++i) {
+        const HotOp& op = hot_ops[i];
+        const uint64_t stage_us = std::max<uint64_t>(1, stage_total_us[op.stage]);
+        fprintf(out, "  %-12s %-12s %8zu %12.3f %12.1f %6.1f%%  %s\n",
+                op.stage, op.kind, op.count, op.total_us / 1000.0, static_cast<double>(op.total_us) / op.count,
+                100.0 * op.total_us / stage_us, op.name.c_str());
+    }
+}
+
+// ----- Context
+// ----------------------------------
+const char* audiogen_status_string(audiogen_status status) {
+    switch (status) {
+        case AUDIOGEN_OK: return "ok";
+        case AUDIOGEN_ERROR_INVALID_ARGUMENT: return "invalid argument";
+        case AUDIOGEN_ERROR_LOAD: return "load error";
+        case AUDIOGEN_ERROR_BUFFER_TOO_SMALL: return "buffer too small";
+        case AUDIOGEN_ERROR_GENERATION: return "generation error";
+        default: return "unknown status";
+    }
+}
+
+const char* audiogen_last_error(void) {
+    return g_last_error.c_str();
+}
+
+void audiogen_config_init(audiogen_config* config, size_t num_threads) {
+    *config = audiogen_config{};
+    config->t5_threads = num_threads;
+    config->dit_threads = num_threads;
+    config->autoencoder_threads = num_threads;
+    config->decode_overlap = 8;
+    config->segment_overlap_sec = k_segment_overlap_sec;
+    config->parallel_load = 1;
+    config->queue_depth = 2;
+}
+
+static std::string to_string(const char* s) {
+    return s != nullptr ? s : "";
+}
+
+// Translate the config of the library, and return the reason why it is invalid, or an empty string
+static std::string get_core_config(const audiogen_config& config, const std::vector<AudioGenCpuCluster>& clusters, AudioGenConfig& core_config) {
+    if (config.t5_threads == 0 || config.dit_threads == 0 || config.autoencoder_threads == 0) {
+        return "the number of threads of each stage must be at least 1";
+    }
+    core_config.threads.t5 = config.t5_threads;
+    core_config.threads.dit = config.dit_threads;
+    core_config.threads.autoencoder = config.autoencoder_threads;
+
+    if ((config.t5_precision != nullptr && !parse_precision(config.t5_precision, core_config.precisions.t5)) ||
+        (config.dit_precision != nullptr && !parse_precision(config.dit_precision, core_config.precisions.dit)) ||
+        (config.autoencoder_precision != nullptr && !parse_precision(config.autoencoder_precision, core_config.precisions.autoencoder))) {
+        return "unknown precision, expected fp32, fp16 or int8";
+    }
+
+    const std::string policy = config.affinity != nullptr ? config.affinity : "none";
+    if (!get_policy_affinity(policy, clusters, core_config.affinity)) {
+        return "unknown affinity policy " + policy;
+    }
+    const struct {
+        const char* list;
+        std::vector<int32_t>& cpus;
+    } cpu_lists[] = {{config.t5_cpus, core_config.affinity.t5},
+                     {config.dit_cpus, core_config.affinity.dit},
+                     {config.autoencoder_cpus, core_config.affinity.autoencoder}};
+    for (const auto& cpu_list : cpu_lists) {
+        if (cpu_list.list != nullptr && !parse_cpu_list(cpu_list.list, cpu_list.cpus)) {
+            return std::string("invalid CPU list ") + cpu_list.list;
+        }
+    }
+
+    if (config.decode_chunk_len > 0 && config.decode_chunk_len <= 2 * config.decode_overlap) {
+        return "the decode chunk must be larger than twice the decode overlap";
+    }
+    if (config.segment_overlap_sec < 0.0f || config.segment_overlap_sec >= k_audio_len_sec / 2) {
+        return "the segment overlap must be shorter than half a segment";
+    }
+    if (config.zero_copy && (config.pipeline || config.decode_chunk_len > 0)) {
+        return "zero-copy cannot be combined with the pipeline or the chunked decoding";
+    }
+    if (config.cond_cache_dir != nullptr && config.cond_cache_entries == 0) {
+        return "the conditioning cache directory requires conditioning cache entries";
+    }
+    if (config.low_memory && (config.pipeline || config.zero_copy || config.profile)) {
+        return "the low-memory mode cannot be combined with the pipeline, zero-copy or profiling";
+    }
+    if (config.huge_pages != nullptr && !parse_huge_pages(config.huge_pages, core_config.huge_pages)) {
+        return std::string("unknown huge pages ") + config.huge_pages + ", expected none, thp or hugetlb";
+    }
+    if (config.low_memory && core_config.huge_pages != AudioGenHugePages::none) {
+        return "the low-memory mode cannot be combined with the huge pages";
+    }
+    if (config.shared_arena && (config.pipeline || config.zero_copy)) {
+        return "the shared arena cannot be combined with the pipeline or zero-copy";
+    }
+    if (config.pipeline && config.queue_depth == 0) {
+        return "the queue depth must be at least 1";
+    }
+
+    core_config.weight_cache_dir = to_string(config.weight_cache_dir);
+    core_config.decode_chunk_len = config.decode_chunk_len;
+    core_config.decode_overlap = config.decode_overlap;
+    core_config.segment_overlap_sec = config.segment_overlap_sec;
+    core_config.zero_copy = config.zero_copy != 0;
+    core_config.cond_cache_entries = config.cond_cache_entries;
+    core_config.cond_cache_dir = to_string(config.cond_cache_dir);
+    core_config.profile = config.profile != 0;
+    core_config.low_memory = config.low_memory != 0;
+    core_config.parallel_load = config.parallel_load != 0;
+    core_config.shared_arena = config.shared_arena != 0;
+    core_config.numa_bind = config.numa_bind != 0;
+    return "";
+}
+
+audiogen_status audiogen_create(const char* models_base_path, const audiogen_config* config, audiogen_context** context) {
+    if (context == nullptr) {
+        return set_last_error(AUDIOGEN_ERROR_INVALID_ARGUMENT, "no context");
+    }
+    *context = nullptr;
+    if (models_base_path == nullptr || config == nullptr) {
+        return set_last_error(AUDIOGEN_ERROR_INVALID_ARGUMENT, "no models path or config");
+    }
+
+    auto new_context = std::make_unique<audiogen_context>();
+    new_context->clusters = get_cpu_clusters();
+
+    AudioGenConfig core_config;
+    const std::string error = get_core_config(*config, new_context->clusters, core_config);
+    if (!error.empty()) {
+        return set_last_error(AUDIOGEN_ERROR_INVALID_ARGUMENT, error);
+    }
+
+    try {
+        load_models(new_context->models, models_base_path, core_config);
+    } catch (const std::exception& e) {
+        return set_last_error(AUDIOGEN_ERROR_LOAD, std::string("cannot load the models of ") + models_base_path + ": " + e.what());
+    }
+
+    // The queue of the worker bounds the submissions that wait for it, like the queues of the pipeline
+    const size_t queue_depth = std::max<size_t>(1, config->queue_depth);
+    if (config->pipeline) {
+        new_context->pipeline = std::make_unique<AudioGenPipeline>(new_context->models, queue_depth);
+    } else {
+        new_context->worker = std::make_unique<AudioGenWorker>(new_context->models, queue_depth);
+    }
+
+    for (const AudioGenProfiledStage& stage : get_profiled_stages(new_context->models)) {
+        stage.profiler->StartProfiling();
+    }
+
+    *context = new_context.release();
+    return AUDIOGEN_OK;
+}
+
+void audiogen_destroy(audiogen_context* context) {
+    if (context == nullptr) {
+        return;
+    }
+    audiogen_flush(context);
+    delete context;
+}
+
+void audiogen_flush(audiogen_context* context) {
+    context->pending.wait_idle();
+}
+
+int32_t audiogen_get_sample_rate(void) {
+    return k_audio_sample_rate;
+}
+
+float audiogen_get_max_audio_len_sec(const audiogen_context* context) {
+    return get_max_audio_len_sec(context->models);
+}
+
+size_t audiogen_get_num_frames(const audiogen_context* context, float audio_len_sec) {
+    const AudioGenModels& models = context->models;
+    if (!std::isfinite(audio_len_sec) || audio_len_sec <= 0.0f || audio_len_sec > k_max_long_audio_len_sec) {
+        return 0;
+    }
+    if (audio_len_sec > get_max_audio_len_sec(models)) {
+        const AudioGenSegment last = plan_segments(models, audio_len_sec, models.segment_overlap_sec).back();
+        return last.start_sample + last.num_samples;
+    }
+    AudioGenJob job;
+    job.audio_len_sec = audio_len_sec;
+    return get_num_audio_samples(models, job);
+}
+
+void audiogen_print_startup_report(const audiogen_context* context, FILE* out) {
+    const AudioGenModels& models = context->models;
+    print_startup_report(out, models.startup);
+    if (!models.affinity.dit.empty()) {
+        print_affinity(out, context->clusters, models.affinity);
+    }
+    if (!models.shared_buffers.empty()) {
+        print_shared_buffers(out, models.shared_buffers);
+    }
+}
+
+void audiogen_print_stats(const audiogen_context* context, FILE* out) {
+    if (context->models.cond_cache.enabled()) {
+        print_cond_cache_stats(out, context->models.cond_cache.stats());
+    }
+}
+
+audiogen_status audiogen_write_profile(audiogen_context* context, const char* trace_path, size_t top_n, FILE* out) {
+    const std::vector<AudioGenProfiledStage> stages = get_profiled_stages(context->models);
+    if (stages.empty() || trace_path == nullptr) {
+        return set_last_error(AUDIOGEN_ERROR_INVALID_ARGUMENT, "the context was not created with profiling");
+    }
+
+    for (const AudioGenProfiledStage& stage : stages) {
+        stage.profiler->StopProfiling();
+    }
+    if (!write_chrome_trace(trace_path, context->models)) {
+        return set_last_error(AUDIOGEN_ERROR_INVALID_ARGUMENT, std::string("cannot write ") + trace_path);
+    }
+    print_hot_ops(out, context->models, top_n);
+    return AUDIOGEN_OK;
+}
+
+static_assert(static_cast<int>(AudioGenSampleFormat::pcm16) == AUDIOGEN_FORMAT_PCM16 && static_cast<int>(AudioGenSampleFormat::pcm24) == AUDIOGEN_FORMAT_PCM24,
+              "the C sample formats must match AudioGenSampleFormat");
+
+size_t audiogen_get_bytes_per_frame(audiogen_sample_format format) {
+    return get_bytes_per_frame(static_cast<AudioGenSampleFormat>(format));
+}
+
+void audiogen_write_wav_header(FILE* out, size_t num_frames, audiogen_sample_format format) {
+    std::ostringstream header;
+    write_wav_header(header, num_frames, static_cast<AudioGenSampleFormat>(format));
+    const std::string bytes = header.str();
+    fwrite(bytes.data(), 1, bytes.size(), out);
+}
+
+// ----- Generation
+// ----------------------------------
+void audiogen_request_init(audiogen_request* request) {
+    *request = audiogen_request{};
+    request->num_steps = k_num_steps;
+    request->audio_len_sec = k_audio_len_sec;
+    request->logsnr_start = k_logsnr_max;
+    request->logsnr_end = k_logsnr_end;
+}
+
+// Translate a request into a job, and return the reason why it is invalid, or an empty string
+static std::string get_job(const audiogen_request& request, AudioGenJob& job) {
+    if (request.prompt == nullptr) {
+        return "no prompt";
+    }
+    if (request.num_steps == 0 || request.audio_len_sec <= 0.0f || request.adaptive_threshold < 0.0f) {
+        return "the number of steps and the length must be positive, and the adaptive threshold at least 0";
+    }
+    if (!std::isfinite(request.audio_len_sec) || request.audio_len_sec > k_max_long_audio_len_sec) {
+        return "the length must be finite and at most " + std::to_string(k_max_long_audio_len_sec) + " seconds";
+    }
+    if (request.sampler != nullptr && !parse_sampler(request.sampler, job.sampler)) {
+        return std::string("unknown sampler ") + request.sampler;
+    }
+    if (!std::isfinite(request.logsnr_start) || !std::isfinite(request.logsnr_end) || !std::isfinite(request.adaptive_threshold)) {
+        return "the logSNR schedule and the adaptive threshold must be finite";
+    }
+    if (request.logsnr_start >= request.logsnr_end) {
+        return "the start of the logSNR schedule must be lower than its end";
+    }
+    if (request.adaptive_threshold > 0.0f && job.sampler != AudioGenSampler::ping_pong) {
+        return "the adaptive schedule requires the ping-pong sampler";
+    }
+    if (request.output == nullptr && request.on_audio == nullptr) {
+        return "no output buffer or audio callback";
+    }
+    if (request.format < AUDIOGEN_FORMAT_F32 || request.format > AUDIOGEN_FORMAT_PCM24) {
+        return "unknown sample format";
+    }
+
+    job.prompt = request.prompt;
+    job.seed = request.seed;
+    job.num_steps = request.num_steps;
+    job.audio_len_sec = request.audio_len_sec;
+    job.logsnr_start = request.logsnr_start;
+    job.logsnr_end = request.logsnr_end;
+    job.adaptive_threshold = request.adaptive_threshold;
+    return "";
+}
+
+audiogen_status audiogen_generate(audiogen_context* context, const audiogen_request* requests, size_t num_requests,
+                                  audiogen_done_callback on_done, void* user_data, audiogen_handle** handle) {
+    if (handle != nullptr) {
+        *handle = nullptr;
+    }
+    if (context == nullptr || requests == nullptr || num_requests == 0) {
+        return set_last_error(AUDIOGEN_ERROR_INVALID_ARGUMENT, "no context or no request");
+    }
+
+    const AudioGenModels& models = context->models;
+
+    auto submission = std::make_shared<AudioGenSubmission>();
+    submission->jobs.resize(num_requests);
+    submission->outputs.resize(num_requests);
+
+    for (size_t b = 0; b < num_requests; ++b) {
+        const std::string error = get_job(requests[b], submission->jobs[b]);
+        if (!error.empty()) {
+            return set_last_error(AUDIOGEN_ERROR_INVALID_ARGUMENT, error);
+        }
+    }
+
+    const AudioGenJob& first = submission->jobs[0];
+    for (const AudioGenJob& job : submission->jobs) {
+        if (job.num_steps != first.num_steps || job.audio_len_sec != first.audio_len_sec || job.adaptive_threshold != first.adaptive_threshold ||
+            job.sampler != first.sampler || job.logsnr_start != first.logsnr_start || job.logsnr_end != first.logsnr_end) {
+            return set_last_error(AUDIOGEN_ERROR_INVALID_ARGUMENT,
+                                  "all the clips of a batch must use the same number of steps, length, adaptive threshold, sampler and sigma schedule");
+        }
+    }
+
+    // The clips longer than the exported latent are generated as overlapping segments, which
+    // use the DiT batch themselves
+    submission->long_form = first.audio_len_sec > get_max_audio_len_sec(models);
+    if (submission->long_form && (num_requests > 1 || context->pipeline != nullptr || !models.shared_buffers.empty())) {
+        return set_last_error(AUDIOGEN_ERROR_INVALID_ARGUMENT, "the length must be at most " + std::to_string(get_max_audio_len_sec(models)) +
+                                                                   " seconds in batches, in pipeline mode and in zero-copy mode");
+    }
+    if (num_requests > 1 && !models.shared_buffers.empty()) {
+        return set_last_error(AUDIOGEN_ERROR_INVALID_ARGUMENT, "batches are not available in zero-copy mode");
+    }
+
+    submission->num_frames = audiogen_get_num_frames(context, first.audio_len_sec);
+    if (submission->long_form) {
+        submission->num_segments = plan_segments(models, first.audio_len_sec, models.segment_overlap_sec).size();
+    }
+
+    for (size_t b = 0; b < num_requests; ++b) {
+        const audiogen_request& request = requests[b];
+        if (request.output != nullptr && request.output_capacity < submission->num_frames) {
+            return set_last_error(AUDIOGEN_ERROR_BUFFER_TOO_SMALL, "the output buffer holds " + std::to_string(request.output_capacity) +
+                                                                       " frames, and the clip " + std::to_string(submission->num_frames));
+        }
+
+        AudioGenClipOutput& output = submission->outputs[b];
+        output.buffer = request.output;
+        output.capacity = request.output_capacity;
+        output.format = static_cast<AudioGenSampleFormat>(request.format);
+        output.on_audio = request.on_audio;
+        output.user_data = request.user_data;
+
+        // The outputs are not resized anymore, so the address of each one is stable
+        AudioGenClipOutput* output_ptr = &output;
+        submission->jobs[b].write_audio = [output_ptr](const float* left_ch, const float* right_ch, size_t num_samples) {
+            write_frames(*output_ptr, left_ch, right_ch, num_samples);
+        };
+    }
+
+    submission->on_done = on_done;
+    submission->user_data = user_data;
+    submission->pending = &context->pending;
+    submission->submit_time = time_in_ms();
+
+    if (handle != nullptr) {
+        *handle = new audiogen_handle{submission};
+    }
+
+    context->pending.add();
+    if (context->pipeline != nullptr) {
+        context->pipeline->submit(std::move(submission));
+    } else {
+        context->worker->submit(std::move(submission));
+    }
+    return AUDIOGEN_OK;
+}
+
+audiogen_status audiogen_wait(audiogen_handle* handle, audiogen_result* result) {
+    AudioGenSubmission& submission = *handle->submission;
+    {
+        std::unique_lock<std::mutex> lock(submission.mutex);
+        submission.done_cv.wait(lock, [&submission]() { return submission.done; });
+    }
+    if (result != nullptr) {
+        *result = submission.result;
+    }
+    return submission.result.status;
+}
+
+int audiogen_is_done(audiogen_handle* handle) {
+    AudioGenSubmission& submission = *handle->submission;
+    std::lock_guard<std::mutex> lock(submission.mutex);
+    return submission.done ? 1 : 0;
+}
+
+void audiogen_release(audiogen_handle* handle) {
+    delete handle;
+}
@@ -0,0 +1,273 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Arm Limited and/or its
+ * affiliates <open-source-office@arm.com>
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBAUDIOGEN_H
+#define LIBAUDIOGEN_H
+
+// libaudiogen runs the audiogen pipeline inside another process. A context owns the loaded
+// models and generates the submitted requests asynchronously on its own threads, one after
+// another or, in pipeline mode, with the stages of consecutive requests overlapped.
+//
+// The audio of each clip is written as interleaved stereo frames (L0, R0, L1, R1, ...) of 32-bit
+// float, or of dithered 16-bit or 24-bit PCM, at audiogen_get_sample_rate() Hz, to a buffer of
+// the caller and to an optional callback that receives it as soon as it is decoded. The library
+// writes no file, except the caches enabled in the config. Errors are returned as status codes
+// and never end the process.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum audiogen_status {
+    AUDIOGEN_OK = 0,
+    // The config or the request is invalid
+    AUDIOGEN_ERROR_INVALID_ARGUMENT = 1,
+    // A model or the tokenizer could not be loaded
+    AUDIOGEN_ERROR_LOAD = 2,
+    // The output buffer of a request is smaller than its audio
+    AUDIOGEN_ERROR_BUFFER_TOO_SMALL = 3,
+    // The generation failed. The context should be destroyed
+    AUDIOGEN_ERROR_GENERATION = 4,
+} audiogen_status;
+
+const char* audiogen_status_string(audiogen_status status);
+
+// Description of the last error returned by audiogen_create() or audiogen_generate() on the
+// calling thread
+const char* audiogen_last_error(void);
+
+// Little-endian sample formats of the output
+typedef enum audiogen_sample_format {
+    AUDIOGEN_FORMAT_F32 = 0,
+    AUDIOGEN_FORMAT_PCM16 = 1,
+    AUDIOGEN_FORMAT_PCM24 = 2,
+} audiogen_sample_format;
+
+// Size of a stereo frame of format, in bytes
+size_t audiogen_get_bytes_per_frame(audiogen_sample_format format);
+
+typedef struct audiogen_context audiogen_context;
+typedef struct audiogen_handle audiogen_handle;
+
+// ----- Context
+// ----------------------------------
+// The strings are copied by audiogen_create(). A NULL string selects the default
+typedef struct audiogen_config {
+    size_t t5_threads;
+    size_t dit_threads;
+    size_t autoencoder_threads;
+
+    // "fp32", "fp16" or "int8". The defaults are fp32 for T5, int8 for the DiT, and fp16 for
+    // the autoencoder
+    const char* t5_precision;
+    const char* dit_precision;
+    const char* autoencoder_precision;
+
+    // Placement policy of the stages: "none", "little", "big" or "prime". The CPU lists of the
+    // stages, like "0-3,6", override it
+    const char* affinity;
+    const char* t5_cpus;
+    const char* dit_cpus;
+    const char* autoencoder_cpus;
+
+    // Directory of the XNNPack packed-weight cache, disabled when NULL
+    const char* weight_cache_dir;
+
+    // Decode the latent in chunks of decode_chunk_len frames, which streams the audio to the
+    // callback of the request chunk by chunk. Disabled when 0
+    size_t decode_chunk_len;
+    size_t decode_overlap;
+
+    // Overlap, in seconds, of the segments of the clips longer than audiogen_get_max_audio_len_sec()
+    float segment_overlap_sec;
+
+    // Share the tensor buffers between consecutive stages. Not available with pipeline,
+    // decode_chunk_len, or batches
+    int zero_copy;
+
+    // Conditioning cache of the last cond_cache_entries distinct prompts, also stored in
+    // cond_cache_dir when set. Disabled when 0
+    size_t cond_cache_entries;
+    const char* cond_cache_dir;
+
+    // Record the latency of every operator, see audiogen_write_profile()
+    int profile;
+
+    // Only keep the DiT loaded between two generations. Not available with pipeline, zero_copy or profile
+    int low_memory;
+
+    // Load the three models concurrently
+    int parallel_load;
+
+    // Release the activations of each stage once it has run, so that the stages reuse the same
+    // memory. Not available with pipeline or zero_copy
+    int shared_arena;
+
+    // Pages of the model weights: "none", "thp" for transparent huge pages, or "hugetlb" for the
+    // reserved huge pages. Not available with low_memory. NULL selects "none"
+    const char* huge_pages;
+
+    // Place the weights and the activations of each stage on the NUMA node of its CPUs
+    int numa_bind;
+
+    // Run the T5, DiT and autoencoder stages of consecutive requests concurrently, each on its
+    // own thread. queue_depth requests are buffered before each stage, and audiogen_generate()
+    // blocks while the first queue is full
+    int pipeline;
+    size_t queue_depth;
+} audiogen_config;
+
+// Fill config with the defaults, with num_threads threads per stage
+void audiogen_config_init(audiogen_config* config, size_t num_threads);
+
+// Load the models of models_base_path. On failure, *context is NULL
+audiogen_status audiogen_create(const char* models_base_path, const audiogen_config* config, audiogen_context** context);
+
+// Wait for the submitted requests, then release the models
+void audiogen_destroy(audiogen_context* context);
+
+// Wait until all the submitted requests are completed
+void audiogen_flush(audiogen_context* context);
+
+int32_t audiogen_get_sample_rate(void);
+
+// Longest clip generated with a single latent. Longer clips are generated as overlapping segments
+float audiogen_get_max_audio_len_sec(const audiogen_context* context);
+
+// Number of stereo frames of a clip of audio_len_sec seconds, or 0 when the length is not
+// positive, not finite or longer than the longest long-form clip (600 seconds)
+size_t audiogen_get_num_frames(const audiogen_context* context, float audio_len_sec);
+
+// Start-up time of each stage, CPU affinity, and shared buffers of the context
+void audiogen_print_startup_report(const audiogen_context* context, FILE* out);
+
+// Statistics of the conditioning cache, when enabled
+void audiogen_print_stats(const audiogen_context* context, FILE* out);
+
+// Stop recording the profile of a context created with profile set, write it as a Chrome trace
+// to trace_path, and print its top_n slowest operators to out. No request must be pending
+audiogen_status audiogen_write_profile(audiogen_context* context, const char* trace_path, size_t top_n, FILE* out);
+
+// Write the header of a WAV file holding num_frames frames of format, which can then be appended
+// as the library outputs them
+void audiogen_write_wav_header(FILE* out, size_t num_frames, audiogen_sample_format format);
+
+// ----- Generation
+// ----------------------------------
+// Called from a thread of the context with the next num_frames frames of a clip, which start at
+// the frame offset of the clip
+typedef void (*audiogen_audio_callback)(void* user_data, const void* frames, size_t offset, size_t num_frames);
+
+// A clip to generate. The prompt and the sampler are copied by audiogen_generate()
+typedef struct audiogen_request {
+    const char* prompt;
+    uint64_t seed;
+    size_t num_steps;
+    float audio_len_sec;
+
+    // "ping-pong", "euler" or "dpmpp-2m", and logSNR range of the sigma schedule
+    const char* sampler;
+    float logsnr_start;
+    float logsnr_end;
+
+    // Threshold of the adaptive DiT schedule, disabled when 0. Requires the ping-pong sampler
+    float adaptive_threshold;
+
+    // Format of the frames written to output and to on_audio
+    audiogen_sample_format format;
+
+    // Buffer of output_capacity frames, which must stay valid until the request is completed.
+    // The frames are converted straight into it. It can be NULL when on_audio is set
+    void* output;
+    size_t output_capacity;
+
+    audiogen_audio_callback on_audio;
+    void* user_data;
+} audiogen_request;
+
+// Fill request with the defaults: 8 steps, 10 seconds, seed 0, the ping-pong sampler and 32-bit float frames
+void audiogen_request_init(audiogen_request* request);
+
+// Latency of each stage of a request, in ms. For a batch, each stage accumulates all the clips
+typedef struct audiogen_timings {
+    long tokenizer_ms;
+    long t5_ms;
+    long dit_ms;
+    float dit_avg_step_ms;
+    long autoencoder_ms;
+    // Time spent handing the audio to the output buffers and callbacks
+    long output_ms;
+    long total_ms;
+    // Time from the start of the request to its first audio frame, and to its completion,
+    // including any queuing
+    long first_sample_ms;
+    long wall_ms;
+    // Time spent loading T5 and the autoencoder in the low-memory mode
+    long load_ms;
+    // Duration of each DiT step, valid until the handle is released
+    const float* dit_step_ms;
+    size_t num_dit_steps;
+    // Number of DiT calls, and of steps extrapolated or skipped by the adaptive schedule
+    size_t dit_steps_run;
+    size_t dit_steps_saved;
+    size_t cond_cache_hits;
+    // Peak resident set size during each stage, in kB, or 0 when it cannot be read
+    size_t peak_rss_t5_kb;
+    size_t peak_rss_dit_kb;
+    size_t peak_rss_autoencoder_kb;
+    // Resident set size once the generation is over, in kB
+    size_t idle_rss_kb;
+} audiogen_timings;
+
+typedef struct audiogen_result {
+    audiogen_status status;
+    // Description of the error, empty on success. Valid until the handle is released
+    const char* error;
+    // Number of frames of each clip, and of segments of a long-form clip (0 otherwise)
+    size_t num_frames;
+    size_t num_segments;
+    audiogen_timings timings;
+} audiogen_result;
+
+// Called from a thread of the context once all the clips of a submission are completed
+typedef void (*audiogen_done_callback)(void* user_data, const audiogen_result* result);
+
+// Submit num_requests clips, which are denoised together as one DiT batch. They must share the
+// number of steps, the length, the sampler, the sigma schedule, and the adaptive threshold.
+// A long-form clip must be submitted alone. on_done can be NULL, and so can handle when the
+// completion is only observed through on_done
+audiogen_status audiogen_generate(audiogen_context* context, const audiogen_request* requests, size_t num_requests,
+                                  audiogen_done_callback on_done, void* user_data, audiogen_handle** handle);
+
+// Block until the submission of handle is completed, and return its status
+audiogen_status audiogen_wait(audiogen_handle* handle, audiogen_result* result);
+
+// Non-zero once the submission of handle is completed
+int audiogen_is_done(audiogen_handle* handle);
+
+void audiogen_release(audiogen_handle* handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LIBAUDIOGEN_H
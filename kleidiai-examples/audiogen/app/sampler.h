@@ -0,0 +1,443 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Arm Limited and/or its
+ * affiliates <open-source-office@arm.com>
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIOGEN_SAMPLER_H
+#define AUDIOGEN_SAMPLER_H
+
+// Diffusion sampler and Gaussian noise generator shared by the audiogen app and the sampler_bench
+// micro-benchmark. The noise comes from a Philox4x32-10 counter-based generator: the value of the
+// i-th sample only depends on the seed, on the stream and on i, so the noise can be generated in
+// blocks, in any order and on any number of threads, and still be the same for a given seed.
+// The loops below are branchless so that the compiler can vectorize them (NEON on Arm® CPUs),
+// which requires -fno-math-errno for std::sqrt.
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// -- Fill sigmas params
+constexpr float k_logsnr_max = -6.0f;
+constexpr float k_logsnr_end = 2.0f;
+constexpr float k_sigma_min = 0.0f;
+constexpr float k_sigma_max = 1.0f;
+
+// -- Philox4x32-10 constants
+constexpr uint32_t k_philox_m0 = 0xD2511F53;
+constexpr uint32_t k_philox_m1 = 0xCD9E8D57;
+constexpr uint32_t k_philox_w0 = 0x9E3779B9;
+constexpr uint32_t k_philox_w1 = 0xBB67AE85;
+constexpr int32_t k_philox_rounds = 10;
+
+// -- Each Philox counter gives 4 normal samples. The noise is generated in blocks of
+// k_rng_block_sz samples, which is also the work granularity of the threads
+constexpr size_t k_rng_lanes = 64;
+constexpr size_t k_rng_block_sz = 4 * k_rng_lanes;
+
+// -- Below this number of samples per thread, waking the threads of the pool costs more than it
+// saves. A wake-up costs a few us, and 8K samples take about 30 us on one core, so a batch of
+// N latents of 16K samples uses up to 2 * N threads
+constexpr size_t k_rng_min_samples_per_thread = 8 * 1024;
+
+// -- The initial noise uses the stream 0 and the step i of the sampler the stream i + 1
+constexpr uint32_t k_rng_stream_init = 0;
+
+// ln(x) for x in (0, 1]
+inline float fast_log(float x) {
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+
+    // x = m * 2^e, with m in [sqrt(2)/2, sqrt(2))
+    constexpr uint32_t k_sqrt_half_bits = 0x3f3504f3;
+    const uint32_t tmp = bits - k_sqrt_half_bits;
+    const int32_t e = static_cast<int32_t>(tmp) >> 23;
+    const uint32_t m_bits = bits - (tmp & 0xff800000u);
+
+    float m;
+    memcpy(&m, &m_bits, sizeof(m));
+
+    // ln(m) = 2 * atanh((m - 1) / (m + 1))
+    const float t = (m - 1.0f) / (m + 1.0f);
+    const float t2 = t * t;
+    const float p = t * (2.0f + t2 * (0.666666667f + t2 * (0.4f + t2 * (0.285714286f + t2 * 0.222222222f))));
+
+    return p + static_cast<float>(e) * 0.693147181f;
+}
+
+// sin(2 * pi * u) and cos(2 * pi * u) for u in [0, 1)
+inline void fast_sincos_2pi(float u, float& s, float& c) {
+    // u = q / 4 + r, with r in [-1/8, 1/8]
+    const int32_t q = static_cast<int32_t>(u * 4.0f + 0.5f);
+    const float a = (u - static_cast<float>(q) * 0.25f) * 6.28318531f;
+    const float a2 = a * a;
+
+    const float sa = a * (1.0f + a2 * (-1.66666667e-1f + a2 * (8.33333333e-3f + a2 * -1.98412698e-4f)));
+    const float ca = 1.0f + a2 * (-0.5f + a2 * (4.16666667e-2f + a2 * (-1.38888889e-3f + a2 * 2.48015873e-5f)));
+
+    // Rotate by q quarter turns: swap sin and cos for the odd quadrants, negate sin
+    // for the quadrants 2 and 3, and cos for the quadrants 1 and 2
+    const uint32_t quadrant = static_cast<uint32_t>(q) & 3;
+    const uint32_t odd_mask = 0u - (quadrant & 1);
+    const uint32_t sign_s = (quadrant >> 1) << 31;
+    const uint32_t sign_c = (((quadrant + 1) >> 1) & 1) << 31;
+
+    uint32_t sa_bits, ca_bits;
+    memcpy(&sa_bits, &sa, sizeof(sa_bits));
+    memcpy(&ca_bits, &ca, sizeof(ca_bits));
+
+    const uint32_t s_bits = ((ca_bits & odd_mask) | (sa_bits & ~odd_mask)) ^ sign_s;
+    const uint32_t c_bits = ((sa_bits & odd_mask) | (ca_bits & ~odd_mask)) ^ sign_c;
+    memcpy(&s, &s_bits, sizeof(s));
+    memcpy(&c, &c_bits, sizeof(c));
+}
+
+// Fill out with the k_rng_block_sz normal samples of the block block_idx
+inline void generate_norm_block(float* out, uint64_t seed, uint32_t stream, uint64_t block_idx) {
+    uint32_t c0[k_rng_lanes];
+    uint32_t c1[k_rng_lanes];
+    uint32_t c2[k_rng_lanes];
+    uint32_t c3[k_rng_lanes];
+
+    for (size_t j = 0; j < k_rng_lanes; ++j) {
+        const uint64_t ctr = block_idx * k_rng_lanes + j;
+        c0[j] = static_cast<uint32_t>(ctr);
+        c1[j] = static_cast<uint32_t>(ctr >> 32);
+        c2[j] = stream;
+        c3[j] = 0;
+    }
+
+    uint32_t k0 = static_cast<uint32_t>(seed);
+    uint32_t k1 = static_cast<uint32_t>(seed >> 32);
+
+    for (int32_t r = 0; r < k_philox_rounds; ++r) {
+        for (size_t j = 0; j < k_rng_lanes; ++j) {
+            const uint64_t p0 = static_cast<uint64_t>(k_philox_m0) * c0[j];
+            const uint64_t p1 = static_cast<uint64_t>(k_philox_m1) * c2[j];
+            const uint32_t n0 = static_cast<uint32_t>(p1 >> 32) ^ c1[j] ^ k0;
+            const uint32_t n2 = static_cast<uint32_t>(p0 >> 32) ^ c3[j] ^ k1;
+            c1[j] = static_cast<uint32_t>(p1);
+            c3[j] = static_cast<uint32_t>(p0);
+            c0[j] = n0;
+            c2[j] = n2;
+        }
+        k0 += k_philox_w0;
+        k1 += k_philox_w1;
+    }
+
+    // Box-Muller transform of the (c0, c1) and (c2, c3) pairs
+    constexpr float k_u24_scale = 1.0f / 16777216.0f;
+
+    for (size_t j = 0; j < k_rng_lanes; ++j) {
+        const float u0 = static_cast<float>((c0[j] >> 8) + 1) * k_u24_scale;  // (0, 1]
+        const float v0 = static_cast<float>(c1[j] >> 8) * k_u24_scale;        // [0, 1)
+        const float u1 = static_cast<float>((c2[j] >> 8) + 1) * k_u24_scale;
+        const float v1 = static_cast<float>(c3[j] >> 8) * k_u24_scale;
+
+        const float r0 = std::sqrt(-2.0f * fast_log(u0));
+        const float r1 = std::sqrt(-2.0f * fast_log(u1));
+
+        float s0, co0, s1, co1;
+        fast_sincos_2pi(v0, s0, co0);
+        fast_sincos_2pi(v1, s1, co1);
+
+        out[j]                   = r0 * co0;
+        out[j + k_rng_lanes]     = r0 * s0;
+        out[j + 2 * k_rng_lanes] = r1 * co1;
+        out[j + 3 * k_rng_lanes] = r1 * s1;
+    }
+}
+
+// Threads of the noise generation and sampler update. They are created once and wait between two
+// calls, so that every sampler step can be split without creating threads. run() is called by
+// one thread at a time
+class AudioGenThreadPool {
+public:
+    // num_threads includes the calling thread of run(). Each worker calls on_start first
+    explicit AudioGenThreadPool(size_t num_threads, const std::function<void()>& on_start = nullptr) {
+        for (size_t w = 1; w < num_threads; ++w) {
+            workers_.emplace_back([this, w, on_start]() {
+                if (on_start) {
+                    on_start();
+                }
+                work(w);
+            });
+        }
+    }
+
+    ~AudioGenThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+            start_.notify_all();
+        }
+        for (std::thread& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    AudioGenThreadPool(const AudioGenThreadPool&) = delete;
+    AudioGenThreadPool& operator=(const AudioGenThreadPool&) = delete;
+
+    size_t get_num_threads() const {
+        return workers_.size() + 1;
+    }
+
+    // Call task(0), ..., task(num_tasks - 1), task(0) on the calling thread, and wait for all of
+    // them. num_tasks is at most get_num_threads()
+    void run(size_t num_tasks, const std::function<void(size_t)>& task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            task_ = &task;
+            num_tasks_ = num_tasks;
+            num_pending_ = num_tasks - 1;
+            ++generation_;
+            start_.notify_all();
+        }
+        task(0);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this]() { return num_pending_ == 0; });
+        task_ = nullptr;
+    }
+
+private:
+    void work(size_t idx) {
+        size_t generation = 0;
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            start_.wait(lock, [this, generation]() { return stop_ || generation_ != generation; });
+            if (stop_) {
+                return;
+            }
+            generation = generation_;
+            if (idx >= num_tasks_) {
+                continue;
+            }
+
+            const std::function<void(size_t)>& task = *task_;
+            lock.unlock();
+            task(idx);
+            lock.lock();
+            if (--num_pending_ == 0) {
+                done_.notify_one();
+            }
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable start_;
+    std::condition_variable done_;
+    const std::function<void(size_t)>* task_ = nullptr;
+    size_t num_tasks_ = 0;
+    size_t num_pending_ = 0;
+    size_t generation_ = 0;
+    bool stop_ = false;
+};
+
+// Number of threads that parallel_for_blocks() uses for sz elements and up to num_threads threads
+inline size_t get_num_workers(size_t sz, size_t num_threads) {
+    const size_t num_blocks = (sz + k_rng_block_sz - 1) / k_rng_block_sz;
+    const size_t max_threads = std::max<size_t>(1, sz / k_rng_min_samples_per_thread);
+    return std::max<size_t>(1, std::min({std::max<size_t>(1, num_threads), max_threads, num_blocks}));
+}
+
+// Call fn(item, block_idx, begin, end) for each block of k_rng_block_sz elements of the num_items
+// items of item_sz elements of a buffer. block_idx counts the blocks from the start of the item,
+// while begin and end are offsets in the whole buffer. The blocks of all the items are split in
+// contiguous ranges across the threads of pool, or run on the calling thread without a pool
+template <typename Fn>
+inline void parallel_for_blocks(size_t num_items, size_t item_sz, AudioGenThreadPool* pool, Fn fn) {
+    const size_t blocks_per_item = (item_sz + k_rng_block_sz - 1) / k_rng_block_sz;
+    const size_t num_blocks = num_items * blocks_per_item;
+    const size_t num_workers = pool != nullptr ? get_num_workers(num_items * item_sz, pool->get_num_threads()) : 1;
+
+    auto run_range = [&fn, item_sz, blocks_per_item](size_t first_block, size_t last_block) {
+        for (size_t g = first_block; g < last_block; ++g) {
+            const size_t item = g / blocks_per_item;
+            const size_t b = g % blocks_per_item;
+            const size_t item_start = item * item_sz;
+            fn(item, b, item_start + b * k_rng_block_sz, item_start + std::min(item_sz, (b + 1) * k_rng_block_sz));
+        }
+    };
+
+    if (num_workers <= 1) {
+        run_range(0, num_blocks);
+        return;
+    }
+
+    const size_t blocks_per_worker = (num_blocks + num_workers - 1) / num_workers;
+    pool->run(num_workers, [&](size_t w) {
+        const size_t first_block = std::min(num_blocks, w * blocks_per_worker);
+        run_range(first_block, std::min(num_blocks, first_block + blocks_per_worker));
+    });
+}
+
+inline void fill_random_norm_dist(float* buff, size_t buff_sz, uint64_t seed, uint32_t stream, AudioGenThreadPool* pool = nullptr) {
+    parallel_for_blocks(1, buff_sz, pool, [=](size_t, size_t block_idx, size_t begin, size_t end) {
+        float noise[k_rng_block_sz];
+        generate_norm_block(noise, seed, stream, block_idx);
+        memcpy(buff + begin, noise, (end - begin) * sizeof(float));
+    });
+}
+
+inline void fill_sigmas(std::vector<float>& arr, float start, float end) {
+
+    const int32_t sz = static_cast<int32_t>(arr.size());
+    const float step = ((end - start) / static_cast<float> (sz - 1));
+
+    // Linspace
+    arr[0]      = start;
+    arr[sz - 1] = end;
+
+    for(int32_t i = 1; i < sz - 1; ++i) {
+        arr[i] = arr[i - 1] + step;
+    }
+
+    for(int32_t i = 0; i < sz; ++i) {
+        arr[i] = 1.0f / (1.0f + std::exp(arr[i])) ;
+    }
+
+    arr[0]      = k_sigma_max;
+    arr[sz - 1] = k_sigma_min;
+}
+
+// The denoised estimate, written to dit_out_data, and the next x are computed in a single pass,
+// together with the noise of the step. The buffers hold one latent of dit_x_in_sz elements per
+// seed, and the noise of each latent comes from its own seed
+inline void sampler_ping_pong(float* dit_out_data, float* dit_x_in_data, size_t dit_x_in_sz, float cur_t, float next_t, size_t step_idx,
+                              const std::vector<uint64_t>& seeds, AudioGenThreadPool* pool = nullptr) {
+    const uint32_t stream = static_cast<uint32_t>(step_idx + 1);
+    const uint64_t* seed_data = seeds.data();
+
+    parallel_for_blocks(seeds.size(), dit_x_in_sz, pool, [=](size_t item, size_t block_idx, size_t begin, size_t end) {
+        float noise[k_rng_block_sz];
+        generate_norm_block(noise, seed_data[item], stream, block_idx);
+
+        float* out = dit_out_data + begin;
+        float* x = dit_x_in_data + begin;
+        for (size_t i = 0; i < end - begin; ++i) {
+            const float denoised = x[i] - (cur_t * out[i]);
+            out[i] = denoised;
+
+            // x = (1-t_next) * denoised + t_next * torch.randn_like(x)
+            x[i] = ((1.0f - next_t) * denoised) + (next_t * noise[i]);
+        }
+    });
+}
+
+// Euler step of the probability flow ODE. The DiT output v is the velocity dx/dt, so the next x is
+// x + (next_t - cur_t) * v. No noise is added, so the result only depends on the initial noise.
+// The denoised estimate is written to dit_out_data
+inline void sampler_euler(float* dit_out_data, float* dit_x_in_data, size_t dit_x_in_sz, float cur_t, float next_t, AudioGenThreadPool* pool = nullptr) {
+    parallel_for_blocks(1, dit_x_in_sz, pool, [=](size_t, size_t, size_t begin, size_t end) {
+        float* out = dit_out_data + begin;
+        float* x = dit_x_in_data + begin;
+        for (size_t i = 0; i < end - begin; ++i) {
+            const float v = out[i];
+            out[i] = x[i] - (cur_t * v);
+            x[i] = x[i] + ((next_t - cur_t) * v);
+        }
+    });
+}
+
+// Step of DPM-Solver++(2M), in the data prediction form, for x = (1 - t) * denoised + t * noise.
+// With lambda = log((1 - t) / t), the first order step is the exact solution for a constant
+// denoised estimate: x_next = (next_t / cur_t) * x + (1 - next_t) * (1 - e^-h) * denoised, with
+// h = lambda(next_t) - lambda(cur_t). The second order step replaces the estimate with its linear
+// extrapolation in lambda from prev_denoised, the estimate of the step at prev_t. prev_t is 0 for the
+// first step, and the last step to next_t = 0 returns the estimate. No noise is added.
+// The denoised estimate is written to dit_out_data, and copied to prev_denoised for the next step
+inline void sampler_dpmpp_2m(float* dit_out_data, float* dit_x_in_data, float* prev_denoised, size_t dit_x_in_sz, float prev_t, float cur_t, float next_t,
+                             AudioGenThreadPool* pool = nullptr) {
+    auto get_lambda = [](float t) { return std::log((1.0f - t) / t); };
+
+    // e^-h, 0 for the first step from cur_t = 1
+    const float exp_neg_h = (next_t * (1.0f - cur_t)) / ((1.0f - next_t) * cur_t);
+
+    // Weight of prev_denoised, 0 for a first order step. The ratio r of the previous step size to the
+    // current one is in lambda, which is infinite at t = 1
+    float prev_weight = 0.0f;
+    if (prev_t > 0.0f && prev_t < 1.0f && next_t > 0.0f) {
+        const float h = get_lambda(next_t) - get_lambda(cur_t);
+        const float h_prev = get_lambda(cur_t) - get_lambda(prev_t);
+        prev_weight = -h / (2.0f * h_prev);
+    }
+
+    parallel_for_blocks(1, dit_x_in_sz, pool, [=](size_t, size_t, size_t begin, size_t end) {
+        float* out = dit_out_data + begin;
+        float* prev = prev_denoised + begin;
+        float* x = dit_x_in_data + begin;
+        for (size_t i = 0; i < end - begin; ++i) {
+            const float denoised = x[i] - (cur_t * out[i]);
+            const float estimate = denoised + prev_weight * (prev[i] - denoised);
+            out[i] = denoised;
+            prev[i] = denoised;
+
+            if (next_t > 0.0f) {
+                x[i] = ((next_t / cur_t) * x[i]) + ((1.0f - next_t) * (1.0f - exp_neg_h) * estimate);
+            } else {
+                x[i] = estimate;
+            }
+        }
+    });
+}
+
+// Relative L2 change between two consecutive denoised estimates, ||cur - prev|| / ||cur||
+inline float get_relative_change(const float* prev, const float* cur, size_t sz) {
+    double diff_sq = 0.0;
+    double norm_sq = 0.0;
+    for (size_t i = 0; i < sz; ++i) {
+        const double diff = static_cast<double>(cur[i]) - prev[i];
+        diff_sq += diff * diff;
+        norm_sq += static_cast<double>(cur[i]) * cur[i];
+    }
+    return norm_sq > 0.0 ? static_cast<float>(std::sqrt(diff_sq / norm_sq)) : 0.0f;
+}
+
+// Step of the ping-pong sampler without a DiT call. The denoised estimate of the step is the linear
+// extrapolation denoised + ratio * (denoised - prev_denoised) of the two previous estimates. It is
+// written to denoised, the previous estimate is moved to prev_denoised, and the next x is computed
+// like in sampler_ping_pong(), with one latent per seed. A ratio of 0 reuses the previous estimate
+inline void sampler_extrapolate(float* prev_denoised, float* denoised, float* dit_x_in_data, size_t dit_x_in_sz, float ratio, float next_t,
+                                size_t step_idx, const std::vector<uint64_t>& seeds, AudioGenThreadPool* pool = nullptr) {
+    const uint32_t stream = static_cast<uint32_t>(step_idx + 1);
+    const uint64_t* seed_data = seeds.data();
+
+    parallel_for_blocks(seeds.size(), dit_x_in_sz, pool, [=](size_t item, size_t block_idx, size_t begin, size_t end) {
+        float noise[k_rng_block_sz];
+        generate_norm_block(noise, seed_data[item], stream, block_idx);
+
+        float* prev = prev_denoised + begin;
+        float* cur = denoised + begin;
+        float* x = dit_x_in_data + begin;
+        for (size_t i = 0; i < end - begin; ++i) {
+            const float extrapolated = cur[i] + ratio * (cur[i] - prev[i]);
+            prev[i] = cur[i];
+            cur[i] = extrapolated;
+            x[i] = ((1.0f - next_t) * extrapolated) + (next_t * noise[i]);
+        }
+    });
+}
+
+#endif // AUDIOGEN_SAMPLER_H
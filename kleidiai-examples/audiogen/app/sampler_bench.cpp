@@ -0,0 +1,168 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Arm Limited and/or its
+ * affiliates <open-source-office@arm.com>
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Micro-benchmark of the sampler step of the audiogen app: the previous implementation, with a
+// std::mt19937 generator and two scalar passes, against the fused Philox sampler of sampler.h
+
+#include "sampler.h"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Latent size of the Stable Audio Open Small DiT model (64 channels x 256 frames)
+constexpr size_t k_default_num_elems = 64 * 256;
+constexpr size_t k_default_num_steps = 8;
+constexpr size_t k_default_batch_sz = 4;
+constexpr size_t k_num_runs = 50;
+
+inline double time_in_us() {
+    using namespace std::chrono;
+    return duration_cast<duration<double, std::micro>>(steady_clock::now().time_since_epoch()).count();
+}
+
+static void sampler_ping_pong_mt19937(float* dit_out_data, float* dit_x_in_data, size_t dit_x_in_sz, float cur_t, float next_t, size_t seed) {
+
+    for(size_t i = 0; i < dit_x_in_sz; i++) {
+        dit_out_data[i] = dit_x_in_data[i] - ( cur_t * dit_out_data[i]);
+    }
+
+    std::mt19937 gen(seed);
+    std::normal_distribution<float> dis(0.0f, 1.0f);
+    std::generate(dit_x_in_data, dit_x_in_data + dit_x_in_sz, [&dis, &gen](){ return dis(gen); });
+
+    for(size_t i = 0; i < dit_x_in_sz; i++) {
+        dit_x_in_data[i] = ((1.0f - next_t) * dit_out_data[i]) + (next_t * dit_x_in_data[i]);
+    }
+}
+
+// Run num_steps sampler steps k_num_runs times and return the average time per step, in us
+template <typename StepFn>
+static double bench_steps(size_t num_elems, size_t num_steps, std::vector<float>& x, StepFn step_fn) {
+    std::vector<float> t_buffer(num_steps + 1);
+    fill_sigmas(t_buffer, k_logsnr_max, 2.0f);
+
+    std::vector<float> out(num_elems);
+
+    double elapsed = 0.0;
+    for (size_t run = 0; run < k_num_runs; ++run) {
+        std::fill(x.begin(), x.end(), 0.5f);
+
+        for (size_t i = 0; i < num_steps; ++i) {
+            // Stand-in for the DiT output
+            std::fill(out.begin(), out.end(), 0.25f);
+
+            const double start = time_in_us();
+            step_fn(out.data(), x.data(), t_buffer[i], t_buffer[i + 1], i);
+            elapsed += time_in_us() - start;
+        }
+    }
+    return elapsed / (k_num_runs * num_steps);
+}
+
+int main(int32_t argc, char** argv) {
+    if (argc > 5) {
+        printf("ERROR: Usage ./sampler_bench [<num_elems>] [<num_steps>] [<num_threads>] [<batch_sz>]\n");
+        return 1;
+    }
+
+    const size_t num_elems = argc > 1 ? std::stoull(argv[1]) : k_default_num_elems;
+    const size_t num_steps = argc > 2 ? std::stoull(argv[2]) : k_default_num_steps;
+    const size_t num_threads = argc > 3 ? std::stoull(argv[3]) : std::max(1u, std::thread::hardware_concurrency());
+    const size_t batch_sz = argc > 4 ? std::stoull(argv[4]) : k_default_batch_sz;
+    const uint64_t seed = 99;
+
+    // The pool is created once, like in the app, so its threads are not counted in the steps
+    AudioGenThreadPool pool(num_threads);
+
+    std::vector<float> x_mt19937(num_elems);
+    std::vector<float> x_philox_1(num_elems);
+    std::vector<float> x_philox_n(num_elems);
+
+    const double us_mt19937 = bench_steps(num_elems, num_steps, x_mt19937,
+        [&](float* out, float* x, float cur_t, float next_t, size_t i) {
+            sampler_ping_pong_mt19937(out, x, num_elems, cur_t, next_t, seed + i + 4564);
+        });
+
+    const double us_philox_1 = bench_steps(num_elems, num_steps, x_philox_1,
+        [&](float* out, float* x, float cur_t, float next_t, size_t i) {
+            sampler_ping_pong(out, x, num_elems, cur_t, next_t, i, {seed});
+        });
+
+    const double us_philox_n = bench_steps(num_elems, num_steps, x_philox_n,
+        [&](float* out, float* x, float cur_t, float next_t, size_t i) {
+            sampler_ping_pong(out, x, num_elems, cur_t, next_t, i, {seed}, &pool);
+        });
+
+    // The whole batch is updated in one call, like between two DiT steps of the app, with one seed
+    // per latent
+    const size_t batch_elems = batch_sz * num_elems;
+    std::vector<uint64_t> seeds(batch_sz);
+    for (size_t b = 0; b < batch_sz; ++b) {
+        seeds[b] = seed + b;
+    }
+
+    std::vector<float> x_batch_1(batch_elems);
+    std::vector<float> x_batch_n(batch_elems);
+
+    const double us_batch_1 = bench_steps(batch_elems, num_steps, x_batch_1,
+        [&](float* out, float* x, float cur_t, float next_t, size_t i) {
+            sampler_ping_pong(out, x, num_elems, cur_t, next_t, i, seeds);
+        });
+
+    const double us_batch_n = bench_steps(batch_elems, num_steps, x_batch_n,
+        [&](float* out, float* x, float cur_t, float next_t, size_t i) {
+            sampler_ping_pong(out, x, num_elems, cur_t, next_t, i, seeds, &pool);
+        });
+
+    // The Philox noise must not depend on the number of threads, and the first latent of the
+    // batch must match the single latent with the same seed
+    const bool is_deterministic = memcmp(x_philox_1.data(), x_philox_n.data(), num_elems * sizeof(float)) == 0 &&
+                                  memcmp(x_batch_1.data(), x_batch_n.data(), batch_elems * sizeof(float)) == 0 &&
+                                  memcmp(x_batch_1.data(), x_philox_1.data(), num_elems * sizeof(float)) == 0;
+
+    // Moments of the Philox noise
+    std::vector<float> noise(std::max<size_t>(num_elems, 1 << 20));
+    fill_random_norm_dist(noise.data(), noise.size(), seed, k_rng_stream_init, &pool);
+    double mean = 0.0;
+    double var = 0.0;
+    for (float v : noise) {
+        mean += v;
+        var += static_cast<double>(v) * v;
+    }
+    mean /= noise.size();
+    var = var / noise.size() - mean * mean;
+
+    const size_t num_workers = get_num_workers(num_elems, num_threads);
+    const size_t num_batch_workers = get_num_workers(batch_elems, num_threads);
+
+    printf("Elements: %zu, steps: %zu, threads: %zu\n", num_elems, num_steps, num_threads);
+    printf("mt19937, 2 passes:           %10.2f us/step\n", us_mt19937);
+    printf("Philox fused, 1 thread:      %10.2f us/step (%.2fx)\n", us_philox_1, us_mt19937 / us_philox_1);
+    printf("Philox fused, %2zu threads:   %10.2f us/step (%.2fx)\n", num_workers, us_philox_n, us_mt19937 / us_philox_n);
+    printf("Batch of %zu latents:\n", batch_sz);
+    printf("Philox fused, 1 thread:      %10.2f us/step\n", us_batch_1);
+    printf("Philox fused, %2zu threads:   %10.2f us/step (%.2fx)\n", num_batch_workers, us_batch_n, us_batch_1 / us_batch_n);
+    printf("Same output with 1 and %zu threads: %s\n", num_batch_workers, is_deterministic ? "yes" : "NO");
+    printf("Philox noise mean: %f, variance: %f\n", mean, var);
+
+    return is_deterministic ? 0 : 1;
+}